@@ -12,10 +12,41 @@ g++ main.cpp -Wall -Wextra `pkg-config opencv4 gtk+-2.0 --cflags --libs` -o "Col
 #include <iostream>
 #include <stdio.h>
 #include <math.h>
+#include <chrono>
+#include <utility>
+#include <thread>
+#include <atomic>
+#include <memory>
+#include <list>
+#include <map>
+#include <mutex>
+#include <condition_variable>
+#include <deque>
+#include <functional>
+#include <algorithm>
+#include <stdint.h>
+#include <string.h>
+#include <limits.h>
+#include <errno.h>
+#include <stdlib.h>
+#include <fcntl.h>
+#include <unistd.h>
+#include <dirent.h>
+#include <signal.h>
+#include <time.h>
+#include <utime.h>
+#include <sys/file.h>
+#include <sys/mman.h>
+#include <sys/inotify.h>
+#include <sys/stat.h>
 #include <opencv2/core.hpp>
+#include <opencv2/core/utility.hpp>
 #include <opencv2/imgcodecs.hpp>
 #include <opencv2/imgproc/imgproc.hpp>
 #include <gtk/gtk.h>
+#ifdef USE_LCMS2
+#include <lcms2.h>
+#endif
 
 using namespace cv;
 using namespace std;
@@ -35,12 +66,164 @@ using namespace std;
 #define GREEN_LUMINANCE 0.587
 #define BLUE_LUMINANCE 0.114
 
+// Operacje zapisywane w tablicy kolorów, zbiór włączonych operacji jest maską bitową
+#define TABLE_OPERATION_CONTRAST 1
+#define TABLE_OPERATION_BRIGHTNESS 2
+#define TABLE_OPERATION_EXPOSURE 4
+#define TABLE_OPERATION_LEVELS 8
+#define TABLE_OPERATION_TEMPERATURE 16
+#define TABLE_OPERATION_HUE 32
+#define TABLE_OPERATION_CURVES 64
+#define TABLE_OPERATIONS_COUNT 7
+
+// Krzywe tonalne: kanały mają indeksy BLUE, GREEN i RED, krzywa wspólna dla wszystkich kanałów ma indeks CURVE_MASTER
+#define CURVE_MAX_POINTS 16
+#define CURVE_MASTER 3
+
+// Rodzaje maski dla lokalnej korekty
+#define MASK_NONE 0
+#define MASK_LINEAR 1
+#define MASK_RADIAL 2
+
+// Odległość w pikselach, z której można chwycić punkt krzywej w interfejsie
+#define CURVE_GRAB_DISTANCE 6
+
+// Operacje wykonywane osobno dla każdego piksela
+#define PIXEL_OPERATION_CLARITY 1
+#define PIXEL_OPERATION_SATURATION 2
+#define PIXEL_OPERATION_TONES 4
+#define PIXEL_OPERATION_VIGNETTE 8
+#define PIXEL_OPERATION_HSL 16
+#define PIXEL_OPERATION_MATRIX 32
+#define PIXEL_OPERATION_LINEAR 64
+#define PIXEL_OPERATIONS_COUNT 7
+
+// Tryb światła liniowego: maksymalna wartość liniowa (16 bitów) oraz liczba bitów indeksu tablicy odwrotnej,
+// luminacja wartości liniowych według wag Rec. 709 (* 4096)
+#define LINEAR_MAX 65535
+#define LINEAR_INVERSE_BITS 12
+#define LINEAR_RED_LUMINANCE 871
+#define LINEAR_GREEN_LUMINANCE 2929
+#define LINEAR_BLUE_LUMINANCE 296
+
+// Liczba węzłów w każdym kierunku tablicy 3D liczonej z profilu ICC monitora
+#define DISPLAY_LUT_SIZE 33
+
+// Balans bieli: temperatura neutralna (bez zmian) w kelwinach oraz zmiana wzmocnienia zielonego dla odcienia 1.0
+#define WHITE_BALANCE_NEUTRAL 6500
+#define TINT_RANGE 0.25
+
+// Korekta w zakresach barw: liczba zakresów, liczba kroków odcienia (6 sektorów po 256) oraz przesunięcie jasności
+// (w poziomach) dla wartości 1.0
+#define HSL_BANDS 8
+#define HUE_STEPS 1536
+#define HSL_LUMINANCE_RANGE 64
+
 // Plik ze schematem interfejsu
 #define UI_FILE "resources/ui.glade"
 
 // Plik ze schematem interfejsu
 #define IMAGE_CONTAINER_MARGIN 5
 
+// Liczba wierszy w jednym paśmie przetwarzanym przez pojedynczy wątek
+#define RENDER_BAND_ROWS 64
+
+// Szerokość pasa kolumn przy pionowym rozmyciu (tyle sum jest trzymanych naraz w cache)
+#define BLUR_TILE_COLUMNS 64
+
+// Promień rozmycia dla klarowności jako ułamek dłuższego boku zdjęcia
+#define CLARITY_RADIUS_DIVISOR 100
+
+// Odszumianie: promień filtru jako ułamek dłuższego boku zdjęcia, bok kafelka (bez marginesu) oraz odchylenie szumu
+// (w poziomach jasności) dla maksymalnej siły, poniżej którego szczegóły są wygładzane
+#define DENOISE_RADIUS_DIVISOR 1500
+#define DENOISE_TILE_SIZE 256
+#define DENOISE_MAX_SIGMA 20.0
+
+// Dłuższy bok pomniejszonej kopii zdjęcia, na której pracuje podgląd w interfejsie
+#define PREVIEW_MAX_SIZE 1600
+
+// Liczba kolumn, na które dzielone jest zdjęcie na wykresie waveform
+#define WAVEFORM_COLUMNS 128
+
+// Co ile milisekund odświeżany jest pasek wczytywania zdjęcia
+#define LOADING_PULSE_INTERVAL 100
+
+// Co ile milisekund odświeżany jest postęp renderu (pasek w interfejsie, procenty w linii poleceń)
+#define RENDER_PROGRESS_INTERVAL 100
+
+// Podpróbkowanie chrominancji w JPEG można ustawić dopiero od OpenCV 4.5.5
+#define HAVE_JPEG_SAMPLING_FACTOR (CV_VERSION_MAJOR > 4 || (CV_VERSION_MAJOR == 4 && (CV_VERSION_MINOR > 5 || (CV_VERSION_MINOR == 5 && CV_VERSION_REVISION >= 5))))
+
+// Flagi dostępu w MatAllocator mają typ AccessFlag dopiero od OpenCV 4.3, wcześniej były zwykłym int
+#if CV_VERSION_MAJOR > 4 || (CV_VERSION_MAJOR == 4 && CV_VERSION_MINOR >= 3)
+typedef AccessFlag AllocatorAccessFlag;
+#else
+typedef int AllocatorAccessFlag;
+#endif
+
+// Pamięć podręczna zdekodowanych zdjęć (katalog względem $XDG_CACHE_HOME lub ~/.cache oraz limit zajmowanego miejsca)
+#define CACHE_DIRECTORY "color-grading-program"
+#define CACHE_EXTENSION ".cgc"
+#define CACHE_MAGIC "CGPCACHE"
+#define CACHE_VERSION 2
+#define CACHE_MAX_LEVELS 16
+#define CACHE_ALIGNMENT 4096
+#define CACHE_MAX_BYTES ((off_t)4 << 30)
+
+// Liczba zapamiętywanych kroków historii ustawień oraz pamięć przeznaczona na zapamiętane rendery podglądu
+#define HISTORY_MAX_STEPS 100
+#define RENDER_CACHE_MAX_BYTES ((size_t)256 << 20)
+
+// Pula buforów pikseli: mniejsze alokacje idą bezpośrednio do OpenCV, bufory od 2 MB mogą korzystać z dużych stron,
+// a zwolnione bufory ponad BUFFER_POOL_MAX_BYTES są oddawane do systemu
+#define BUFFER_POOL_MIN_BYTES 65536
+#define BUFFER_POOL_ALIGNMENT 4096
+#define BUFFER_POOL_HUGE_PAGE_BYTES ((size_t)2 << 20)
+#define BUFFER_POOL_MAX_BYTES ((size_t)512 << 20)
+
+// Rozmiar bufora na zdarzenia inotify w trybie obserwowania katalogu
+#define WATCH_EVENT_BUFFER 65536
+
+// Liczba zdekodowanych zdjęć czekających między etapami potoku (kolejka ścieżek do dekodowania nie ma limitu,
+// żeby wątek obserwujący katalog nigdy nie czekał i nie gubił zdarzeń inotify)
+#define BATCH_QUEUE_CAPACITY 2
+
+// Zadanie wsadowe: liczba pozycji zajętych naraz przez jeden proces oraz wiek, po którym zajęcie uznawane jest za porzucone
+#define BATCH_MAX_IN_FLIGHT 3
+#define BATCH_CLAIM_STALE_SECONDS 3600
+
+// Maksymalne powiększenie podglądu (względem oryginalnej rozdzielczości)
+#define ZOOM_MAX 8.0
+
+// Przybliżona liczba pikseli próbkowanych przy automatycznym doborze ustawień
+#define AUTO_SAMPLE_PIXELS 262144
+
+// Percentyle luminacji (w promilach) traktowane jako czerń i biel przy automatycznym doborze ustawień
+#define AUTO_BLACK_PERMILLE 5
+#define AUTO_WHITE_PERMILLE 995
+
+// Docelowa mediana luminacji (średnia szarość w sRGB)
+#define AUTO_TARGET_MEDIAN 118
+
+// Krzywa tonalna przechodząca przez punkty kontrolne (x rosnące), count == 0 oznacza krzywą tożsamościową
+struct ToneCurve
+{
+    int count = 0;
+    unsigned char x[CURVE_MAX_POINTS] = {};
+    unsigned char y[CURVE_MAX_POINTS] = {};
+};
+
+// Maska gradientowa we współrzędnych względnych kadru (0-1), dzięki czemu działa tak samo na podglądzie, wycinku i pełnym zdjęciu
+// Liniowa: parameters to punkt pełnego działania (x, y) i punkt, w którym działanie zanika (x, y)
+// Radialna: parameters to środek (x, y), promienie elipsy (x, y) oraz szerokość przejścia jako ułamek promienia
+struct GradientMask
+{
+    int type = MASK_NONE;
+    float parameters[5] = {0.0, 0.0, 0.0, 0.0, 0.0};
+    bool invert = false;
+};
+
 // Struktura przechowująca ustawienia
 struct Settings
 {
@@ -56,7 +239,205 @@ struct Settings
     float shadows = 0.0;
     float midtones = 0.0;
     float highlights = 0.0;
+    float clarity = 0.0;
+    float vignette = 0.0;
+    float denoise = 0.0;
+    float sharpen = 0.0;
+    float hslSaturation[HSL_BANDS] = {};
+    float hslLuminance[HSL_BANDS] = {};
+    int whiteBalance = WHITE_BALANCE_NEUTRAL;
+    float tint = 0.0;
+    bool linearLight = false;
+
+    // Mikser kanałów, indeksy [kanał wyjściowy][kanał wejściowy] to RED, GREEN i BLUE
+    float channelMixer[3][3] = {{1.0, 0.0, 0.0}, {0.0, 1.0, 0.0}, {0.0, 0.0, 1.0}};
+    bool autoAdjust = false;
     string outputPath;
+    string exportSpec;
+    string exportProfile;
+    bool encodeBenchmark = false;
+    string referencePath;
+    int referenceTolerance = 0;
+    int benchmarkRuns = 0;
+    float benchmarkMinMegapixels = 0.0;
+    bool poolStats = false;
+    string watchDirectory;
+    string presetPath;
+    string outputDirectory;
+    string batchManifest;
+    ToneCurve curves[4];
+    GradientMask mask;
+    string maskPresetPath;
+    string displayProfile;
+
+    // Druga transformacja mieszana według maski, obiekt jest niezmienny, więc kopie ustawień (np. w historii) mogą go współdzielić
+    shared_ptr<const Settings> maskGrade;
+
+    // Krzywe wypełnione do tablic przy każdej zmianie punktów, tablica kolorów tylko je składa
+    unsigned char curveTable[4][256];
+
+    Settings()
+    {
+        for(int curve = 0; curve < 4; curve++)
+        {
+            for(int value = 0; value < 256; value++)
+            {
+                curveTable[curve][value] = value;
+            }
+        }
+    }
+};
+
+// Struktura przechowująca histogramy RGB oraz waveform luminacji (liczniki pikseli w każdej kolumnie dla każdego poziomu)
+struct Scopes
+{
+    unsigned int histogram[3][256];
+    unsigned int waveform[WAVEFORM_COLUMNS][256];
+};
+
+// Tablice operacji na pikselach liczone raz na render z ustawień oraz położenia renderowanego wycinka w kadrze
+struct PixelTables
+{
+    vector<int> vignetteColumns;
+    vector<int> vignetteRows;
+    vector<int> hslSaturation;
+    vector<int> hslLuminance;
+    int colorMatrix[3][3];
+};
+
+// Przekształcenie kolorów sRGB do przestrzeni monitora jako tablica 3D (size^3 węzłów RGB, czerwony zmienia się najszybciej),
+// indeksy węzłów i wagi interpolacji dla każdej wartości 0-255 są liczone raz przy wczytaniu
+struct DisplayLut
+{
+    int size = 0;
+    vector<uchar> table;
+    int gridIndex[256];
+    int gridWeight[256];
+};
+
+// Postęp renderu publikowany po każdym ukończonym paśmie oraz flaga przerwania sprawdzana przed rozpoczęciem kolejnego pasma
+struct RenderProgress
+{
+    atomic<bool> cancelled;
+    atomic<int> rowsDone;
+    atomic<int> rowsTotal;
+
+    RenderProgress() : cancelled(false), rowsDone(0), rowsTotal(0) {}
+};
+
+// Tożsamość zdjęcia źródłowego: pełna ścieżka, urządzenie i i-węzeł, czas modyfikacji z nanosekundami oraz rozmiar
+struct CacheKey
+{
+    char path[PATH_MAX];
+    uint64_t device;
+    uint64_t inode;
+    int64_t modifiedSeconds;
+    int64_t modifiedNanoseconds;
+    int64_t size;
+};
+
+// Nagłówek pliku w pamięci podręcznej, za nim kolejne poziomy (BGR, wiersze bez wyrównania) zaczynające się od offset
+// Klucz zapisany w nagłówku jest porównywany przy wczytaniu, więc kolizja skrótu w nazwie pliku nie zwróci cudzych pikseli
+struct CacheHeader
+{
+    char magic[8];
+    uint32_t version;
+    uint32_t levels;
+    CacheKey key;
+    int32_t rows[CACHE_MAX_LEVELS];
+    int32_t cols[CACHE_MAX_LEVELS];
+    uint64_t offset[CACHE_MAX_LEVELS];
+};
+
+// Zmapowany plik z pamięci podręcznej, Mat wskazujące na jego dane są ważne tak długo jak istnieje ten obiekt
+struct ImageCache
+{
+    void *data;
+    size_t size;
+
+    ImageCache(void *data, size_t size) : data(data), size(size) {}
+    ~ImageCache()
+    {
+        munmap(data, size);
+    }
+};
+
+// Jeden plik wyjściowy eksportu, maxSize to dłuższy bok (0 oznacza pełną rozdzielczość)
+struct ExportOutput
+{
+    string path;
+    int maxSize = 0;
+};
+
+// Zapamiętany render podglądu razem z histogramami, hash to skrót ustawień, którymi został wykonany
+struct RenderCacheEntry
+{
+    uint64_t hash;
+    Mat image;
+    Scopes scopes;
+};
+
+// Struktura przekazywana między wątkiem wczytującym zdjęcie a interfejsem
+// generation pozwala odrzucić wynik, jeśli w międzyczasie wybrano inny plik
+struct AppData;
+struct LoadJob
+{
+    AppData *appData;
+    int generation;
+    string filename;
+    bool success = false;
+    Mat imageOriginal;
+    Mat imagePreview;
+    vector<Mat> imagePyramid;
+    shared_ptr<ImageCache> imageCache;
+};
+
+// Wątek roboczy interfejsu (np. wczytywanie zdjęcia), finished ustawiane jest po zakończeniu pracy,
+// dzięki czemu zakończone wątki mogą być dołączane bez czekania
+struct WorkerThread
+{
+    thread handle;
+    shared_ptr<atomic<bool>> finished;
+};
+
+// Statystyki puli buforów (trafienia, alokacje z systemu oraz zajęta pamięć)
+struct BufferPoolStats
+{
+    size_t hits = 0;
+    size_t misses = 0;
+    size_t bytesInUse = 0;
+    size_t peakBytes = 0;
+    size_t bytesPooled = 0;
+};
+
+// Render podglądu wykonywany w osobnym wątku na kopii ustawień i z własnymi tablicami,
+// dzięki czemu przerwany render może dokończyć pasmo bez wpływu na następny
+struct RenderJob
+{
+    AppData *appData;
+    shared_ptr<RenderProgress> progress;
+    uint64_t hash;
+    Settings settings;
+    Mat imageSource;
+    Mat image;
+    Scopes scopes;
+    int lookUpTable[256][3];
+    float tonesLookUpTable[256];
+};
+
+// Render powiększonego wycinka w osobnym wątku, level to poziom piramidy, a region to wycinek tego poziomu
+struct ZoomRenderJob
+{
+    AppData *appData;
+    shared_ptr<RenderProgress> progress;
+    uint64_t hash;
+    int level;
+    Rect region;
+    Settings settings;
+    Mat levelImage;
+    Mat image;
+    int lookUpTable[256][3];
+    float tonesLookUpTable[256];
 };
 
 // Struktura przechowująca wskaźniki na ustawienia oraz obiekt przechowujący elementy interfejsu
@@ -64,6 +445,17 @@ struct AppData
 {
     Mat image;
     Mat imageOriginal;
+    Mat imagePreview;
+    vector<Mat> imagePyramid;
+    shared_ptr<ImageCache> imageCache;
+    Scopes scopes;
+    bool scopesReady = false;
+    vector<Settings> undoHistory;
+    vector<Settings> redoHistory;
+    Settings appliedSettings;
+    bool appliedSettingsValid = false;
+    list<RenderCacheEntry> renderCache;
+    size_t renderCacheBytes = 0;
     Settings *userSettings;
     const Settings *defaultSettings;
     int *lookUpTable;
@@ -72,8 +464,34 @@ struct AppData
     int imageSizeWidth;
     int imageSizeHeight;
     bool displayOriginalPhoto = false;
+    atomic<int> loadGeneration;
+    list<WorkerThread> workers;
+    bool loading = false;
+    bool applyAfterLoading = false;
+    shared_ptr<RenderProgress> renderProgress;
+    bool renderProgressShown = false;
+    Settings displayedSettings;
+    float zoom = 0.0;
+    float panX = 0.5, panY = 0.5;
+    Mat zoomImage;
+    int zoomLevel = -1;
+    Rect zoomRegion;
+    uint64_t zoomHash = 0;
+    shared_ptr<RenderProgress> zoomProgress;
+    int zoomPendingLevel = -1;
+    Rect zoomPendingRegion;
+    uint64_t zoomPendingHash = 0;
+    double dragX, dragY;
     GtkBuilder **builder;
     GtkWidget **imageContainer;
+    GtkWidget **scopesArea;
+    GtkWidget **curveArea;
+    shared_ptr<DisplayLut> displayLut;
+    int curveChannel = CURVE_MASTER;
+    int curvePoint = -1;
+    int hslBand = 0;
+    GtkWidget **loadingProgress;
+    GtkWidget **exportSpecEntry;
     GtkFileChooserButton **chooseFileButton;
     GObject **brightnessButton;
     GObject **contrastButton;
@@ -83,8 +501,185 @@ struct AppData
     GObject **hueRedButton, **hueGreenButton, **hueBlueButton;
     GObject **liftButton, **gammaButton, **gainButton;
     GObject **shadowsButton, **midtonesButton, **highlightsButton;
+    GObject **clarityButton;
+    GObject **vignetteButton;
+    GObject **denoiseButton;
+    GObject **sharpenButton;
+    GObject **whiteBalanceButton;
+    GObject **tintButton;
+    GObject **linearLightButton;
+    GObject **hslSaturationButton;
+    GObject **hslLuminanceButton;
+};
+
+
+// --------------
+//  PULA BUFORÓW
+// --------------
+
+// Alokator dla Mat (oraz pikseli Pixbuf) trzymający zwolnione bufory w klasach rozmiarów, dzięki czemu kolejne rendery,
+// podglądy i zdjęcia wsadowe tej samej wielkości nie alokują pamięci od nowa ani nie płacą za pierwsze dotknięcie stron
+class BufferPool : public MatAllocator
+{
+public:
+    // Rozmiar zaokrąglany jest w górę do ćwiartki potęgi dwójki, ale zawsze do pełnych stron
+    static size_t sizeClass(size_t size)
+    {
+        size_t base = BUFFER_POOL_ALIGNMENT;
+        while(base * 2 < size)
+        {
+            base *= 2;
+        }
+        size_t step = max(base / 4, (size_t)BUFFER_POOL_ALIGNMENT);
+        return (size + step - 1) / step * step;
+    }
+
+    void *take(size_t size) const
+    {
+        size_t capacity = sizeClass(size);
+        {
+            lock_guard<mutex> guard(poolMutex);
+            stats.bytesInUse += capacity;
+            stats.peakBytes = max(stats.peakBytes, stats.bytesInUse);
+
+            map<size_t, vector<void *> >::iterator buffers = freeBuffers.find(capacity);
+            if(buffers != freeBuffers.end() && buffers->second.size() > 0)
+            {
+                void *data = buffers->second.back();
+                buffers->second.pop_back();
+                stats.bytesPooled -= capacity;
+                stats.hits++;
+                return data;
+            }
+            stats.misses++;
+        }
+
+        void *data = NULL;
+        if(posix_memalign(&data, BUFFER_POOL_ALIGNMENT, capacity) != 0)
+        {
+            lock_guard<mutex> guard(poolMutex);
+            stats.bytesInUse -= capacity;
+            return NULL;
+        }
+#ifdef MADV_HUGEPAGE
+        if(capacity >= BUFFER_POOL_HUGE_PAGE_BYTES)
+        {
+            madvise(data, capacity, MADV_HUGEPAGE);
+        }
+#endif
+        return data;
+    }
+
+    void give(void *data, size_t size) const
+    {
+        size_t capacity = sizeClass(size);
+        {
+            lock_guard<mutex> guard(poolMutex);
+            stats.bytesInUse -= capacity;
+            if(stats.bytesPooled + capacity <= BUFFER_POOL_MAX_BYTES)
+            {
+                freeBuffers[capacity].push_back(data);
+                stats.bytesPooled += capacity;
+                return;
+            }
+        }
+        free(data);
+    }
+
+    BufferPoolStats getStats() const
+    {
+        lock_guard<mutex> guard(poolMutex);
+        return stats;
+    }
+
+    // Odpowiednik StdMatAllocator z OpenCV, różni się tylko źródłem pamięci
+    UMatData *allocate(int dims, const int *sizes, int type, void *data0, size_t *step, AllocatorAccessFlag /*flags*/, UMatUsageFlags /*usageFlags*/) const override
+    {
+        size_t total = CV_ELEM_SIZE(type);
+        for(int i = dims - 1; i >= 0; i--)
+        {
+            if(step)
+            {
+                if(data0 && step[i] != CV_AUTOSTEP)
+                {
+                    CV_Assert(total <= step[i]);
+                    total = step[i];
+                }
+                else
+                {
+                    step[i] = total;
+                }
+            }
+            total *= sizes[i];
+        }
+
+        uchar *data = (uchar *)data0;
+        if(!data)
+        {
+            data = (uchar *)(total >= BUFFER_POOL_MIN_BYTES ? take(total) : fastMalloc(total));
+            if(!data)
+            {
+                CV_Error(Error::StsNoMem, "Brak pamięci na bufor zdjęcia");
+            }
+        }
+
+        UMatData *u = new UMatData(this);
+        u->data = u->origdata = data;
+        u->size = total;
+        if(data0)
+        {
+            u->flags |= UMatData::USER_ALLOCATED;
+        }
+        return u;
+    }
+
+    bool allocate(UMatData *u, AllocatorAccessFlag /*accessFlags*/, UMatUsageFlags /*usageFlags*/) const override
+    {
+        return u != NULL;
+    }
+
+    void deallocate(UMatData *u) const override
+    {
+        if(!u)
+        {
+            return;
+        }
+        CV_Assert(u->urefcount == 0);
+        CV_Assert(u->refcount == 0);
+        if(!(u->flags & UMatData::USER_ALLOCATED))
+        {
+            if(u->size >= BUFFER_POOL_MIN_BYTES)
+            {
+                give(u->origdata, u->size);
+            }
+            else
+            {
+                fastFree(u->origdata);
+            }
+            u->origdata = 0;
+        }
+        delete u;
+    }
+
+private:
+    mutable mutex poolMutex;
+    mutable map<size_t, vector<void *> > freeBuffers;
+    mutable BufferPoolStats stats;
 };
 
+// Pula jest celowo niezwalniana, Mat mogą być niszczone jeszcze po zakończeniu main
+BufferPool *bufferPool()
+{
+    static BufferPool *pool = new BufferPool();
+    return pool;
+}
+
+void printBufferPoolStats()
+{
+    BufferPoolStats stats = bufferPool()->getStats();
+    cout << "Pula buforów: " << stats.hits << " trafień, " << stats.misses << " alokacji, szczyt " << stats.peakBytes / (1 << 20) << " MB, w puli " << stats.bytesPooled / (1 << 20) << " MB" << endl;
+}
+
 
 // -----------------------------------------
 //  PODSTAWOWE FUNKCJE OPERUJĄCE NA ZDJĘCIU
@@ -127,6 +722,49 @@ int exposure(int inputValue, float exposureValue)
     return valueInRange(inputValue * pow(2, exposureValue));
 }
 
+// Tablice przejścia między sRGB a światłem liniowym: 8 bitów do 16 bitów oraz odwrotna indeksowana 12 najstarszymi bitami
+// wartości liniowej (z zaokrągleniem przejście tam i z powrotem nie zmienia żadnej wartości)
+struct LinearTables
+{
+    unsigned short toLinear[256];
+    uchar fromLinear[(1 << LINEAR_INVERSE_BITS) + 1];
+};
+
+const LinearTables *linearTables()
+{
+    static const LinearTables tables = []()
+    {
+        LinearTables values;
+        for(int value = 0; value < 256; value++)
+        {
+            double encoded = value / 255.0;
+            double linear = encoded <= 0.04045 ? encoded / 12.92 : pow((encoded + 0.055) / 1.055, 2.4);
+            values.toLinear[value] = lround(linear * LINEAR_MAX);
+        }
+        for(int index = 0; index <= (1 << LINEAR_INVERSE_BITS); index++)
+        {
+            double linear = (double)index / (1 << LINEAR_INVERSE_BITS);
+            double encoded = linear <= 0.0031308 ? linear * 12.92 : 1.055 * pow(linear, 1.0 / 2.4) - 0.055;
+            values.fromLinear[index] = lround(encoded * 255.0);
+        }
+        return values;
+    }();
+    return &tables;
+}
+
+int linearToValue(const LinearTables *tables, int linear)
+{
+    int shift = 16 - LINEAR_INVERSE_BITS;
+    return tables->fromLinear[(min(max(linear, 0), LINEAR_MAX) + (1 << (shift - 1))) >> shift];
+}
+
+// Ekspozycja jako mnożenie ilości światła, a nie zakodowanej wartości (jasne kolory nie tracą nasycenia szybciej niż ciemne)
+int exposureLinear(int inputValue, float exposureValue)
+{
+    const LinearTables *tables = linearTables();
+    return linearToValue(tables, tables->toLinear[inputValue] * pow(2, exposureValue));
+}
+
 int liftGammaGain(int inputValue, int lift, float gamma, float gain)
 {
     return valueInRange((float)lift + gain * gammaCorrection(inputValue, gamma));
@@ -157,6 +795,25 @@ Vec3b saturation(Vec3b colorVector, float saturationValue, int *pixelLuminance)
     return colorVector;
 }
 
+// Saturacja w świetle liniowym: luminacja i odległość od niej liczone są z wartości liniowych
+Vec3b saturationLinear(Vec3b colorVector, float saturationValue, const LinearTables *tables)
+{
+    int factor = saturationValue * 256.0f + 0.5f;
+    int light[3];
+
+    for(int i = 0; i <= 2; i++)
+    {
+        light[i] = tables->toLinear[colorVector[i]];
+    }
+    int luminance = (light[RED] * LINEAR_RED_LUMINANCE + light[GREEN] * LINEAR_GREEN_LUMINANCE + light[BLUE] * LINEAR_BLUE_LUMINANCE) >> 12;
+
+    for(int i = 0; i <= 2; i++)
+    {
+        colorVector[i] = linearToValue(tables, luminance + (((light[i] - luminance) * factor) >> 8));
+    }
+    return colorVector;
+}
+
 Vec3b shadowsMidtonesHihlights(Vec3b colorVector, float *tonesLookUpTable, int *pixelLuminance)
 {
     //int luminance = (colorVector[RED] * RED_LUMINANCE) + (colorVector[GREEN] * GREEN_LUMINANCE) + (colorVector[BLUE] * BLUE_LUMINANCE);
@@ -168,7 +825,34 @@ Vec3b shadowsMidtonesHihlights(Vec3b colorVector, float *tonesLookUpTable, int *
     return colorVector;
 }
 
-void createLookUpTable(Settings *userSettings, const Settings *defaultSettings, int *lookUpTable)
+int activeTableOperations(Settings *userSettings, const Settings *defaultSettings)
+{
+    int operations = 0;
+
+    if(userSettings->contrast != defaultSettings->contrast)
+        operations |= TABLE_OPERATION_CONTRAST;
+    if(userSettings->brightness != defaultSettings->brightness)
+        operations |= TABLE_OPERATION_BRIGHTNESS;
+    if(userSettings->exposure != defaultSettings->exposure)
+        operations |= TABLE_OPERATION_EXPOSURE;
+    if(userSettings->lift != defaultSettings->lift || userSettings->gamma != defaultSettings->gamma || userSettings->gain != defaultSettings->gain)
+        operations |= TABLE_OPERATION_LEVELS;
+    if(userSettings->colorTemperature != defaultSettings->colorTemperature)
+        operations |= TABLE_OPERATION_TEMPERATURE;
+    if(userSettings->hue[RED] != defaultSettings->hue[RED] || userSettings->hue[GREEN] != defaultSettings->hue[GREEN] || userSettings->hue[BLUE] != defaultSettings->hue[BLUE])
+        operations |= TABLE_OPERATION_HUE;
+    for(int curve = 0; curve < 4; curve++)
+    {
+        if(userSettings->curves[curve].count > 0)
+            operations |= TABLE_OPERATION_CURVES;
+    }
+
+    return operations;
+}
+
+// Wersja funkcji dla konkretnego zbioru operacji, warunki są stałymi czasu kompilacji
+template<int operations>
+void createLookUpTableKernel(Settings *userSettings, int *lookUpTable)
 {
     for(int colorIndex = 0; colorIndex < 256; colorIndex++)
     {
@@ -177,20 +861,25 @@ void createLookUpTable(Settings *userSettings, const Settings *defaultSettings,
         for(int colorChannel = 0; colorChannel <= 2; colorChannel++)
         {
             colorVector[colorChannel] = colorIndex;
-            if(userSettings->contrast != defaultSettings->contrast)
+            if(operations & TABLE_OPERATION_CONTRAST)
                 colorVector[colorChannel] = contrast(colorVector[colorChannel], userSettings->contrast);
-            if(userSettings->brightness != defaultSettings->brightness)
+            if(operations & TABLE_OPERATION_BRIGHTNESS)
                 colorVector[colorChannel] = brightness(colorVector[colorChannel], userSettings->brightness);
-            if(userSettings->exposure != defaultSettings->exposure)
-                colorVector[colorChannel] = exposure(colorVector[colorChannel], userSettings->exposure);
-            if(userSettings->lift != defaultSettings->lift || userSettings->gamma != defaultSettings->gamma || userSettings->gain != defaultSettings->gain)
+            if(operations & TABLE_OPERATION_EXPOSURE)
+                colorVector[colorChannel] = userSettings->linearLight ? exposureLinear(colorVector[colorChannel], userSettings->exposure) : exposure(colorVector[colorChannel], userSettings->exposure);
+            if(operations & TABLE_OPERATION_LEVELS)
                 colorVector[colorChannel] = liftGammaGain(colorVector[colorChannel], userSettings->lift, userSettings->gamma, userSettings->gain);            
         }
 
-        if(userSettings->colorTemperature != defaultSettings->colorTemperature)
+        if(operations & TABLE_OPERATION_TEMPERATURE)
             colorVector = colorTemperature(colorVector, userSettings->colorTemperature);
-        if(userSettings->hue[RED] != defaultSettings->hue[RED] || userSettings->hue[GREEN] != defaultSettings->hue[GREEN] || userSettings->hue[BLUE] != defaultSettings->hue[BLUE])
+        if(operations & TABLE_OPERATION_HUE)
             colorVector = hue(colorVector, userSettings->hue[RED], userSettings->hue[GREEN], userSettings->hue[BLUE]);
+        if(operations & TABLE_OPERATION_CURVES)
+        {
+            for(int colorChannel = 0; colorChannel <= 2; colorChannel++)
+                colorVector[colorChannel] = userSettings->curveTable[colorChannel][userSettings->curveTable[CURVE_MASTER][colorVector[colorChannel]]];
+        }
 
         *((lookUpTable + colorIndex * 3) + RED) = colorVector[RED];
         *((lookUpTable + colorIndex * 3) + GREEN) = colorVector[GREEN];
@@ -198,6 +887,22 @@ void createLookUpTable(Settings *userSettings, const Settings *defaultSettings,
     }
 }
 
+typedef void (*LookUpTableKernel)(Settings *, int *);
+
+// Tablica wskaźników na wszystkie warianty funkcji, indeksowana maską operacji
+template<int... operations>
+LookUpTableKernel selectLookUpTableKernel(int activeOperations, integer_sequence<int, operations...>)
+{
+    static const LookUpTableKernel kernels[] = { &createLookUpTableKernel<operations>... };
+    return kernels[activeOperations];
+}
+
+void createLookUpTable(Settings *userSettings, const Settings *defaultSettings, int *lookUpTable)
+{
+    int operations = activeTableOperations(userSettings, defaultSettings);
+    selectLookUpTableKernel(operations, make_integer_sequence<int, 1 << TABLE_OPERATIONS_COUNT>())(userSettings, lookUpTable);
+}
+
 void createTonesLookUpTable(Settings *userSettings, float *tonesLookUpTable)
 {
     for(int luminance = 0; luminance < 256; luminance++)
@@ -212,366 +917,3928 @@ void createTonesLookUpTable(Settings *userSettings, float *tonesLookUpTable)
     }
 }
 
-void transformImage(Mat image, Settings *userSettings, const Settings *defaultSettings, int *lookUpTable, float *tonesLookUpTable)
+// Styczna krzywej w punkcie kontrolnym (Fritsch-Butland): zależy tylko od sąsiednich punktów, więc przesunięcie punktu
+// zmienia krzywą tylko w najbliższych odcinkach, a średnia harmoniczna nachyleń nie pozwala krzywej wyjść poza punkty
+float curveTangent(ToneCurve *curve, int point)
 {
-    for(int y = 0; y < image.rows; y++)
+    int last = curve->count - 1;
+    if(point == 0)
     {
-        for(int x = 0; x < image.cols; x++)
-        {
-            Vec3b color = image.at<Vec3b>(Point(x,y));
-
-            int pixelLuminance = (color[RED] * RED_LUMINANCE) + (color[GREEN] * GREEN_LUMINANCE) + (color[BLUE] * BLUE_LUMINANCE);
-
-            if(userSettings->saturation != defaultSettings->saturation)
-                color = saturation(color, userSettings->saturation, &pixelLuminance);
-            if(userSettings->shadows != defaultSettings->shadows || userSettings->midtones != defaultSettings->midtones || userSettings->highlights != defaultSettings->highlights)
-                color = shadowsMidtonesHihlights(color, tonesLookUpTable, &pixelLuminance);
-
-            for(int i = 0; i <= 2; i++)
-            {
-                color[i] = *((lookUpTable + color[i] * 3) + i);
-            }
-
-            image.at<Vec3b>(Point(x,y)) = color;
-        }
+        return (float)(curve->y[1] - curve->y[0]) / (curve->x[1] - curve->x[0]);
+    }
+    if(point == last)
+    {
+        return (float)(curve->y[last] - curve->y[last - 1]) / (curve->x[last] - curve->x[last - 1]);
     }
-}
-
 
-// -----------------------------------------------
-//  FUNKCJE POZWALAJĄCE NA TRASFORMOWANIE ZDJĘCIA
-// -----------------------------------------------
+    float widthBefore = curve->x[point] - curve->x[point - 1];
+    float widthAfter = curve->x[point + 1] - curve->x[point];
+    float slopeBefore = (curve->y[point] - curve->y[point - 1]) / widthBefore;
+    float slopeAfter = (curve->y[point + 1] - curve->y[point]) / widthAfter;
 
-bool openFile(Mat &image, Mat &imageOriginal, string *imageName)
-{
-    image = imread(samples::findFile(*imageName, false, true), IMREAD_COLOR);
-    if(image.empty())
+    if(slopeBefore * slopeAfter <= 0.0)
     {
-        cout <<  "Nie można otworzyć lub znaleźć pliku o nazwie " << *imageName << "!" << endl ;
-        return false;
+        return 0.0;
     }
-    imageOriginal = image.clone();
-    return true;
+    return 3.0 * (widthBefore + widthAfter) / ((2.0 * widthAfter + widthBefore) / slopeBefore + (widthAfter + 2.0 * widthBefore) / slopeAfter);
 }
 
-bool saveFile(Mat image, string *outputPath)
+// Wypełnienie tablicy krzywej w odcinkach między punktami firstPoint i lastPoint (sześcienny Hermite),
+// przed pierwszym i za ostatnim punktem krzywa jest stała
+void bakeToneCurve(ToneCurve *curve, unsigned char *curveTable, int firstPoint, int lastPoint)
 {
-    if(!image.empty())
+    if(curve->count < 2)
     {
-        if(imwrite(*outputPath, image))
+        for(int value = 0; value < 256; value++)
         {
-            cout <<  "Plik zapisany w ścieżce " << *outputPath << "!" << endl ;
-            return true;
+            curveTable[value] = value;
         }
+        return;
     }
-    cout <<  "Nie udało się zapisać pliku w ścieżce " << *outputPath << "!" << endl ;
-    return false;
-}
-
-void updateImageWithSettings(Mat &image, Mat &imageOriginal, Settings *userSettings, const Settings *defaultSettings, int *lookUpTable, float *tonesLookUpTable)
-{
-    // Benchmarking
-    clock_t start;
-    double duration;
-    start = clock();
-
-    // Transformowanie zdjęcia
-    createLookUpTable(userSettings, defaultSettings, lookUpTable);
-    createTonesLookUpTable(userSettings, tonesLookUpTable);
-
-    image = imageOriginal.clone();
-    transformImage(image, userSettings, defaultSettings, lookUpTable, tonesLookUpTable);
 
-    // Benchmarking
-    duration = (clock() - start) / (double)CLOCKS_PER_SEC;
-    cout << "Render zdjęcia: "<< duration << "s" << endl;
-}
+    int last = curve->count - 1;
+    firstPoint = max(0, firstPoint);
+    lastPoint = min(last, lastPoint);
+
+    if(firstPoint == 0)
+    {
+        for(int value = 0; value < curve->x[0]; value++)
+        {
+            curveTable[value] = curve->y[0];
+        }
+    }
+    if(lastPoint == last)
+    {
+        for(int value = curve->x[last] + 1; value < 256; value++)
+        {
+            curveTable[value] = curve->y[last];
+        }
+    }
+
+    for(int point = firstPoint; point < lastPoint; point++)
+    {
+        float width = curve->x[point + 1] - curve->x[point];
+        float tangentStart = curveTangent(curve, point) * width;
+        float tangentEnd = curveTangent(curve, point + 1) * width;
+
+        for(int value = curve->x[point]; value <= curve->x[point + 1]; value++)
+        {
+            float t = (value - curve->x[point]) / width;
+            float t2 = t * t, t3 = t2 * t;
+            float result = (2.0 * t3 - 3.0 * t2 + 1.0) * curve->y[point] + (t3 - 2.0 * t2 + t) * tangentStart
+                         + (-2.0 * t3 + 3.0 * t2) * curve->y[point + 1] + (t3 - t2) * tangentEnd;
+            curveTable[value] = valueInRange(lround(result));
+        }
+    }
+}
+
+// Przesunięcie punktu podczas przeciągania, x ograniczone jest przez sąsiednie punkty
+// Zmieniają się styczne tylko w tym punkcie i jego sąsiadach, więc ponownie wypełniane są cztery najbliższe odcinki
+void moveCurvePoint(ToneCurve *curve, unsigned char *curveTable, int point, int x, int y)
+{
+    int xMin = point > 0 ? curve->x[point - 1] + 1 : 0;
+    int xMax = point < curve->count - 1 ? curve->x[point + 1] - 1 : 255;
+
+    curve->x[point] = min(max(x, xMin), xMax);
+    curve->y[point] = valueInRange(y);
+    bakeToneCurve(curve, curveTable, point - 2, point + 2);
+}
+
+// Dodanie punktu (krzywa tożsamościowa dostaje najpierw punkty skrajne), zwraca jego indeks lub -1
+int insertCurvePoint(ToneCurve *curve, unsigned char *curveTable, int x, int y)
+{
+    if(curve->count == 0)
+    {
+        curve->count = 2;
+        curve->x[0] = 0;
+        curve->y[0] = 0;
+        curve->x[1] = 255;
+        curve->y[1] = 255;
+    }
+
+    int point = 0;
+    while(point < curve->count && curve->x[point] < x)
+    {
+        point++;
+    }
+    if(curve->count >= CURVE_MAX_POINTS || (point < curve->count && curve->x[point] == x))
+    {
+        return -1;
+    }
+
+    for(int i = curve->count; i > point; i--)
+    {
+        curve->x[i] = curve->x[i - 1];
+        curve->y[i] = curve->y[i - 1];
+    }
+    curve->x[point] = x;
+    curve->y[point] = valueInRange(y);
+    curve->count++;
+
+    bakeToneCurve(curve, curveTable, point - 2, point + 2);
+    return point;
+}
+
+// Usunięcie punktu, krzywa z mniej niż dwoma punktami wraca do tożsamościowej
+void removeCurvePoint(ToneCurve *curve, unsigned char *curveTable, int point)
+{
+    if(curve->count <= 2)
+    {
+        *curve = ToneCurve();
+        bakeToneCurve(curve, curveTable, 0, 0);
+        return;
+    }
+
+    for(int i = point; i < curve->count - 1; i++)
+    {
+        curve->x[i] = curve->x[i + 1];
+        curve->y[i] = curve->y[i + 1];
+    }
+    curve->count--;
+    curve->x[curve->count] = 0;
+    curve->y[curve->count] = 0;
+
+    bakeToneCurve(curve, curveTable, point - 2, point + 1);
+}
+
 
 
 // ---------------------------------------------------
-//  FUNKCJE SPRAWDZAJĄCE ARGUMENTY WCZYTANE Z KONSOLI
+//  FUNKCJE OPERUJĄCE NA SĄSIEDZTWIE PIKSELI
 // ---------------------------------------------------
 
-bool checkArgumentInt(char **argv, int *argc, int i, string flag, int *userSetting, int valueMin, int valueMax)
+// Rozmycie pudełkowe jednego wiersza sumą kroczącą, koszt nie zależy od promienia
+void boxBlurRow(const uchar *source, uchar *destination, int width, int radius)
 {
-    if((string)argv[i] == flag && (i + 1) < *argc){
-        int argVal = stoi(argv[i + 1]);
-        if( argVal < valueMax && argVal > valueMin)
+    int windowSize = 2 * radius + 1;
+    int reciprocal = 65536 / windowSize;
+    int sum = (radius + 1) * source[0];
+
+    for(int x = 1; x <= radius; x++)
+    {
+        sum += source[min(x, width - 1)];
+    }
+
+    for(int x = 0; x < width; x++)
+    {
+        destination[x] = (sum * reciprocal + 32768) >> 16;
+        sum += source[min(x + radius + 1, width - 1)] - source[max(x - radius, 0)];
+    }
+}
+
+// Rozmycie pudełkowe pasa kolumn, sumy kroczące trzymane są dla całego wiersza pasa naraz
+void boxBlurColumns(Mat source, Mat destination, int radius, int columnStart, int columnEnd)
+{
+    int windowSize = 2 * radius + 1;
+    int reciprocal = 65536 / windowSize;
+    int width = columnEnd - columnStart;
+    vector<int> sums(width);
+
+    for(int x = 0; x < width; x++)
+    {
+        sums[x] = (radius + 1) * source.ptr<uchar>(0)[columnStart + x];
+    }
+    for(int y = 1; y <= radius; y++)
+    {
+        const uchar *sourceRow = source.ptr<uchar>(min(y, source.rows - 1)) + columnStart;
+        for(int x = 0; x < width; x++)
         {
-            *userSetting = argVal;
+            sums[x] += sourceRow[x];
         }
-        else
+    }
+
+    for(int y = 0; y < source.rows; y++)
+    {
+        uchar *destinationRow = destination.ptr<uchar>(y) + columnStart;
+        const uchar *addedRow = source.ptr<uchar>(min(y + radius + 1, source.rows - 1)) + columnStart;
+        const uchar *removedRow = source.ptr<uchar>(max(y - radius, 0)) + columnStart;
+
+        for(int x = 0; x < width; x++)
         {
-            cout << "Błędna wartość!" << endl;
-            return true;
+            destinationRow[x] = (sums[x] * reciprocal + 32768) >> 16;
+            sums[x] += addedRow[x] - removedRow[x];
         }
     }
-    return false;
 }
 
-bool checkArgumentFloat(char **argv, int *argc, int i, string flag, float *userSetting, float valueMin, float valueMax)
+// Przybliżenie rozmycia Gaussa trzema przejściami rozmycia pudełkowego w każdym kierunku
+// Wiersze przetwarzane są pasmami, a kolumny pasami po BLUR_TILE_COLUMNS, żeby dane mieściły się w cache
+void fastGaussianBlur(Mat source, Mat &destination, int radius, RenderProgress *progress)
 {
-    if((string)argv[i] == flag && (i + 1) < *argc){
-        float argVal = stof(argv[i + 1]);
-        if( argVal <= valueMax && argVal >= valueMin)
+    Mat temporary(source.rows, source.cols, CV_8UC1);
+    destination.create(source.rows, source.cols, CV_8UC1);
+
+    int bands = (source.rows + RENDER_BAND_ROWS - 1) / RENDER_BAND_ROWS;
+    parallel_for_(Range(0, bands), [&](const Range &range)
+    {
+        vector<uchar> rowBuffer(source.cols);
+
+        for(int band = range.start; band < range.end; band++)
         {
-            *userSetting = argVal;
+            if(progress != NULL && progress->cancelled)
+                return;
+
+            for(int y = band * RENDER_BAND_ROWS; y < min((band + 1) * RENDER_BAND_ROWS, source.rows); y++)
+            {
+                boxBlurRow(source.ptr<uchar>(y), destination.ptr<uchar>(y), source.cols, radius);
+                boxBlurRow(destination.ptr<uchar>(y), &rowBuffer[0], source.cols, radius);
+                boxBlurRow(&rowBuffer[0], temporary.ptr<uchar>(y), source.cols, radius);
+            }
         }
-        else
+    });
+
+    int tiles = (source.cols + BLUR_TILE_COLUMNS - 1) / BLUR_TILE_COLUMNS;
+    parallel_for_(Range(0, tiles), [&](const Range &range)
+    {
+        for(int tile = range.start; tile < range.end; tile++)
         {
-            cout << "Błędna wartość!" << endl;
-            return true;
+            if(progress != NULL && progress->cancelled)
+                return;
+
+            int columnStart = tile * BLUR_TILE_COLUMNS;
+            int columnEnd = min(columnStart + BLUR_TILE_COLUMNS, source.cols);
+
+            boxBlurColumns(temporary, destination, radius, columnStart, columnEnd);
+            boxBlurColumns(destination, temporary, radius, columnStart, columnEnd);
+            boxBlurColumns(temporary, destination, radius, columnStart, columnEnd);
+        }
+    });
+}
+
+// Promień zależy od wielkości całego zdjęcia, żeby podgląd, wycinek i eksport wyglądały tak samo
+int clarityRadius(Mat image)
+{
+    return max(1, max(image.rows, image.cols) / CLARITY_RADIUS_DIVISOR);
+}
+
+// Rozmyta luminacja zdjęcia, z której transformImage wylicza lokalny kontrast
+void createClarityBlur(Mat image, Mat &clarityBlur, int radius, RenderProgress *progress)
+{
+    Mat luminance(image.rows, image.cols, CV_8UC1);
+
+    int bands = (image.rows + RENDER_BAND_ROWS - 1) / RENDER_BAND_ROWS;
+    parallel_for_(Range(0, bands), [&](const Range &range)
+    {
+        for(int y = range.start * RENDER_BAND_ROWS; y < min(range.end * RENDER_BAND_ROWS, image.rows); y++)
+        {
+            const Vec3b *imageRow = image.ptr<Vec3b>(y);
+            uchar *luminanceRow = luminance.ptr<uchar>(y);
+
+            for(int x = 0; x < image.cols; x++)
+            {
+                luminanceRow[x] = (imageRow[x][RED] * RED_LUMINANCE) + (imageRow[x][GREEN] * GREEN_LUMINANCE) + (imageRow[x][BLUE] * BLUE_LUMINANCE);
+            }
+        }
+    });
+
+    fastGaussianBlur(luminance, clarityBlur, radius, progress);
+}
+
+// Promień zależy od wielkości całego zdjęcia, więc podgląd odszumiany jest proporcjonalnie mniejszym filtrem
+int denoiseRadius(Mat image)
+{
+    return max(1, max(image.rows, image.cols) / DENOISE_RADIUS_DIVISOR);
+}
+
+// Prostokąt powiększony o margines z każdej strony i przycięty do granic zdjęcia
+Rect expandRegion(Rect region, int margin, Size size)
+{
+    int left = max(0, region.x - margin), top = max(0, region.y - margin);
+    return Rect(left, top, min(size.width, region.x + region.width + margin) - left, min(size.height, region.y + region.height + margin) - top);
+}
+
+// Filtr prowadzony (guided filter) z każdym kanałem jako własnym przewodnikiem: w oknie o wariancji dużo mniejszej od eps
+// piksel zastępowany jest średnią, a przy krawędziach (duża wariancja) zostaje prawie bez zmian
+// Zdjęcie dzielone jest na kafelki DENOISE_TILE_SIZE przetwarzane równolegle, każdy z marginesem 2 * promień (dwa kolejne
+// uśrednienia), więc pamięć robocza zależy tylko od liczby wątków, a nie od rozmiaru zdjęcia
+// Po anulowaniu renderu pozostałe kafelki są pomijane (wynik jest wtedy niekompletny)
+void denoiseImage(Mat source, Mat &destination, float denoiseValue, int radius, RenderProgress *progress)
+{
+    float eps = (denoiseValue * DENOISE_MAX_SIGMA) * (denoiseValue * DENOISE_MAX_SIGMA);
+    Size window(2 * radius + 1, 2 * radius + 1);
+    int tilesX = (source.cols + DENOISE_TILE_SIZE - 1) / DENOISE_TILE_SIZE;
+    int tilesY = (source.rows + DENOISE_TILE_SIZE - 1) / DENOISE_TILE_SIZE;
+
+    destination.create(source.rows, source.cols, CV_8UC3);
+
+    parallel_for_(Range(0, tilesX * tilesY), [&](const Range &range)
+    {
+        for(int tileIndex = range.start; tileIndex < range.end; tileIndex++)
+        {
+            if(progress != NULL && progress->cancelled)
+                return;
+
+            int tileX = (tileIndex % tilesX) * DENOISE_TILE_SIZE, tileY = (tileIndex / tilesX) * DENOISE_TILE_SIZE;
+            Rect tile(tileX, tileY, min(DENOISE_TILE_SIZE, source.cols - tileX), min(DENOISE_TILE_SIZE, source.rows - tileY));
+            Rect tileWithMargin = expandRegion(tile, 2 * radius, source.size());
+
+            Mat guide, mean, meanSquare, meanA, meanB;
+            source(tileWithMargin).convertTo(guide, CV_32F);
+            boxFilter(guide, mean, -1, window, Point(-1, -1), true, BORDER_REPLICATE);
+            boxFilter(guide.mul(guide), meanSquare, -1, window, Point(-1, -1), true, BORDER_REPLICATE);
+
+            // Współczynniki q = a * p + b dla każdego okna, potem uśredniane po wszystkich oknach zawierających piksel
+            Mat a(guide.rows, guide.cols, CV_32FC3), b(guide.rows, guide.cols, CV_32FC3);
+            for(int y = 0; y < guide.rows; y++)
+            {
+                const float *meanRow = mean.ptr<float>(y);
+                const float *meanSquareRow = meanSquare.ptr<float>(y);
+                float *aRow = a.ptr<float>(y);
+                float *bRow = b.ptr<float>(y);
+
+                for(int x = 0; x < guide.cols * 3; x++)
+                {
+                    float variance = max(0.0f, meanSquareRow[x] - meanRow[x] * meanRow[x]);
+                    aRow[x] = variance / (variance + eps);
+                    bRow[x] = (1.0f - aRow[x]) * meanRow[x];
+                }
+            }
+            boxFilter(a, meanA, -1, window, Point(-1, -1), true, BORDER_REPLICATE);
+            boxFilter(b, meanB, -1, window, Point(-1, -1), true, BORDER_REPLICATE);
+
+            int offsetX = tile.x - tileWithMargin.x, offsetY = tile.y - tileWithMargin.y;
+            for(int y = 0; y < tile.height; y++)
+            {
+                const float *guideRow = guide.ptr<float>(y + offsetY) + offsetX * 3;
+                const float *aRow = meanA.ptr<float>(y + offsetY) + offsetX * 3;
+                const float *bRow = meanB.ptr<float>(y + offsetY) + offsetX * 3;
+                uchar *destinationRow = destination.ptr<uchar>(tile.y + y) + tile.x * 3;
+
+                for(int x = 0; x < tile.width * 3; x++)
+                {
+                    destinationRow[x] = saturate_cast<uchar>(aRow[x] * guideRow[x] + bRow[x]);
+                }
+            }
+        }
+    });
+}
+
+// Maska wyostrzająca (unsharp mask) liczona w rozdzielczości pliku wyjściowego, rozmycie to separowalny filtr [1 2 1] x [1 2 1] / 16
+// Rozmyty wiersz powstaje w buforze pasma z trzech sąsiednich wierszy źródła, więc całość to jedno równoległe przejście
+// bez kopii rozmytego zdjęcia, a wyostrzenie to mnożenie na liczbach całkowitych (siła * 256)
+void sharpenImage(Mat source, Mat &destination, float sharpenValue)
+{
+    int strength = sharpenValue * 256.0f + 0.5f;
+    int width = source.cols * 3;
+
+    destination.create(source.rows, source.cols, CV_8UC3);
+
+    int bands = (source.rows + RENDER_BAND_ROWS - 1) / RENDER_BAND_ROWS;
+    parallel_for_(Range(0, bands), [&](const Range &range)
+    {
+        vector<int> columnSums(width);
+
+        for(int y = range.start * RENDER_BAND_ROWS; y < min(range.end * RENDER_BAND_ROWS, source.rows); y++)
+        {
+            const uchar *previousRow = source.ptr<uchar>(max(y - 1, 0));
+            const uchar *sourceRow = source.ptr<uchar>(y);
+            const uchar *nextRow = source.ptr<uchar>(min(y + 1, source.rows - 1));
+            uchar *destinationRow = destination.ptr<uchar>(y);
+
+            for(int x = 0; x < width; x++)
+            {
+                columnSums[x] = previousRow[x] + 2 * sourceRow[x] + nextRow[x];
+            }
+
+            for(int x = 0; x < width; x++)
+            {
+                int blurred = columnSums[max(x - 3, x % 3)] + 2 * columnSums[x] + columnSums[min(x + 3, width - 3 + x % 3)];
+                int detail = sourceRow[x] * 16 - blurred;
+                destinationRow[x] = saturate_cast<uchar>(sourceRow[x] + ((detail * strength) >> 12));
+            }
         }
+    });
+}
+
+Vec3b clarity(Vec3b colorVector, float clarityValue, int *pixelLuminance, int blurredLuminance)
+{
+    int detail = clarityValue * (*pixelLuminance - blurredLuminance);
+
+    colorVector[RED] = brightness(colorVector[RED], detail);
+    colorVector[GREEN] = brightness(colorVector[GREEN], detail);
+    colorVector[BLUE] = brightness(colorVector[BLUE], detail);
+    *pixelLuminance = valueInRange(*pixelLuminance + detail);
+
+    return colorVector;
+}
+
+int activePixelOperations(Settings *userSettings, const Settings *defaultSettings)
+{
+    int operations = 0;
+
+    if(userSettings->clarity != defaultSettings->clarity)
+        operations |= PIXEL_OPERATION_CLARITY;
+    if(userSettings->saturation != defaultSettings->saturation)
+        operations |= PIXEL_OPERATION_SATURATION;
+    if(userSettings->shadows != defaultSettings->shadows || userSettings->midtones != defaultSettings->midtones || userSettings->highlights != defaultSettings->highlights)
+        operations |= PIXEL_OPERATION_TONES;
+    if(userSettings->vignette != defaultSettings->vignette)
+        operations |= PIXEL_OPERATION_VIGNETTE;
+    if(memcmp(userSettings->hslSaturation, defaultSettings->hslSaturation, sizeof(userSettings->hslSaturation)) != 0 ||
+       memcmp(userSettings->hslLuminance, defaultSettings->hslLuminance, sizeof(userSettings->hslLuminance)) != 0)
+        operations |= PIXEL_OPERATION_HSL;
+    if(userSettings->whiteBalance != defaultSettings->whiteBalance || userSettings->tint != defaultSettings->tint ||
+       memcmp(userSettings->channelMixer, defaultSettings->channelMixer, sizeof(userSettings->channelMixer)) != 0)
+        operations |= PIXEL_OPERATION_MATRIX;
+    if(userSettings->linearLight && (operations & (PIXEL_OPERATION_SATURATION | PIXEL_OPERATION_MATRIX | PIXEL_OPERATION_VIGNETTE)))
+        operations |= PIXEL_OPERATION_LINEAR;
+
+    return operations;
+}
+
+// Wzmocnienie winiety exp(k * d^2) rozkłada się na iloczyn czynnika kolumny i czynnika wiersza (d^2 = dx^2 + dy^2),
+// więc obie tablice (wzmocnienie * 256) liczone są raz na render, a w pętli zostaje jedno mnożenie na piksel
+// Ujemna wartość przyciemnia brzegi kadru (winieta), dodatnia je rozjaśnia (korekta spadku jasności obiektywu)
+void createVignetteTables(float vignetteValue, int cols, int rows, Point origin, Size frameSize, vector<int> &vignetteColumns, vector<int> &vignetteRows)
+{
+    float halfWidth = frameSize.width / 2.0f, halfHeight = frameSize.height / 2.0f;
+    float strength = logf(max(0.05f, 1.0f + vignetteValue)) / (halfWidth * halfWidth + halfHeight * halfHeight);
+
+    vignetteColumns.resize(cols);
+    vignetteRows.resize(rows);
+
+    for(int x = 0; x < cols; x++)
+    {
+        float distance = origin.x + x + 0.5f - halfWidth;
+        vignetteColumns[x] = 256.0f * expf(strength * distance * distance) + 0.5f;
+    }
+    for(int y = 0; y < rows; y++)
+    {
+        float distance = origin.y + y + 0.5f - halfHeight;
+        vignetteRows[y] = 256.0f * expf(strength * distance * distance) + 0.5f;
     }
-    return false;
 }
 
-bool checkArgumentString(char **argv, int *argc, int i, string flag, string *userSetting)
+// Środki zakresów barw w krokach odcienia: czerwony, pomarańczowy, żółty, zielony, akwamaryna, niebieski, fioletowy, purpurowy
+const int hslBandCenters[HSL_BANDS] = {0, 128, 256, 512, 768, 1024, 1152, 1280};
+
+// Odwrotności nasycenia (max - min) przeskalowane tak, żeby (różnica * odwrotność) >> 16 dawało 0-256 wewnątrz sektora
+const int *hueReciprocals()
 {
-    if((string)argv[i] == flag && (i + 1) < *argc){
-        string argVal = (string)argv[i + 1];
-        if(argVal.size() > 0)
+    static const vector<int> reciprocals = []()
+    {
+        vector<int> values(256, 0);
+        for(int chroma = 1; chroma < 256; chroma++)
         {
-            *userSetting = argVal;
+            values[chroma] = (256 << 16) / chroma;
         }
-        else
+        return values;
+    }();
+    return &reciprocals[0];
+}
+
+// Odcień w krokach 0 - HUE_STEPS liczony na liczbach całkowitych (sektor według największej składowej i położenie w nim),
+// bez zamiany na HSV i atan2
+int hueStep(Vec3b color, int maximum, int chroma, const int *reciprocals)
+{
+    int reciprocal = reciprocals[chroma];
+
+    if(maximum == color[RED])
+        return color[GREEN] >= color[BLUE] ? ((color[GREEN] - color[BLUE]) * reciprocal) >> 16 : HUE_STEPS - (((color[BLUE] - color[GREEN]) * reciprocal) >> 16);
+    if(maximum == color[GREEN])
+        return 512 + (((color[BLUE] - color[RED]) * reciprocal) >> 16);
+    return 1024 + (((color[RED] - color[GREEN]) * reciprocal) >> 16);
+}
+
+// Ustawienia zakresów interpolowane liniowo między sąsiednimi środkami (z zawinięciem purpurowy - czerwony),
+// nasycenie jako mnożnik * 256, jasność jako przesunięcie w poziomach
+void createHslTables(Settings *userSettings, vector<int> &hslSaturation, vector<int> &hslLuminance)
+{
+    hslSaturation.resize(HUE_STEPS);
+    hslLuminance.resize(HUE_STEPS);
+
+    for(int band = 0; band < HSL_BANDS; band++)
+    {
+        int next = (band + 1) % HSL_BANDS;
+        int start = hslBandCenters[band];
+        int end = next == 0 ? HUE_STEPS : hslBandCenters[next];
+
+        for(int step = start; step < end; step++)
         {
-            cout << "Błędna wartość!" << endl;
-            return true;
+            float position = (float)(step - start) / (float)(end - start);
+            float saturationValue = userSettings->hslSaturation[band] + position * (userSettings->hslSaturation[next] - userSettings->hslSaturation[band]);
+            float luminanceValue = userSettings->hslLuminance[band] + position * (userSettings->hslLuminance[next] - userSettings->hslLuminance[band]);
+
+            hslSaturation[step] = 256.0f * (1.0f + saturationValue) + 0.5f;
+            hslLuminance[step] = lroundf(HSL_LUMINANCE_RANGE * luminanceValue);
         }
     }
-    return false;
 }
 
+// Zmiana nasycenia i jasności według odcienia piksela, przesunięcie jasności maleje razem z nasyceniem piksela,
+// więc szarości (o przypadkowym odcieniu) zostają bez zmian
+Vec3b hueSaturationLuminance(Vec3b colorVector, const int *hslSaturation, const int *hslLuminance, const int *reciprocals, int *pixelLuminance)
+{
+    int maximum = max(colorVector[RED], max(colorVector[GREEN], colorVector[BLUE]));
+    int chroma = maximum - min(colorVector[RED], min(colorVector[GREEN], colorVector[BLUE]));
+    if(chroma == 0)
+        return colorVector;
 
-// ---------------------------------------------------
-//  FUNKCJE KONWERTUJĄCE ZDJĘCIE Z TYPU Mat DO Pixbuf
-// ---------------------------------------------------
+    int step = hueStep(colorVector, maximum, chroma, reciprocals);
+    int factor = hslSaturation[step];
+    int offset = (hslLuminance[step] * chroma) >> 8;
 
-void calculateImageSize(AppData *appData, int *width, int *height)
+    for(int i = 0; i <= 2; i++)
+    {
+        colorVector[i] = valueInRange(*pixelLuminance + (((colorVector[i] - *pixelLuminance) * factor) >> 8) + offset);
+    }
+    *pixelLuminance = valueInRange(*pixelLuminance + offset);
+
+    return colorVector;
+}
+
+// Kolor ciała doskonale czarnego o danej temperaturze (przybliżenie krzywymi dopasowanymi do tablic CIE, 1000 - 40000 K)
+void blackBodyColor(int kelvin, float *color)
 {
-    float widthFloat, heightFloat;
+    float temperature = kelvin / 100.0f;
 
-    if(appData->image.cols > appData->image.rows)
+    color[RED] = temperature <= 66.0f ? 255.0f : 329.698727446f * powf(temperature - 60.0f, -0.1332047592f);
+    color[GREEN] = temperature <= 66.0f ? 99.4708025861f * logf(temperature) - 161.1195681661f : 288.1221695283f * powf(temperature - 60.0f, -0.0755148492f);
+    color[BLUE] = temperature >= 66.0f ? 255.0f : (temperature <= 19.0f ? 0.0f : 138.5177312231f * logf(temperature - 10.0f) - 305.0447927307f);
+}
+
+// Macierz mikseru poprzedzona wzmocnieniami balansu bieli (światło o temperaturze whiteBalance staje się neutralne,
+// zielony ma wzmocnienie 1 zmieniane tylko przez odcień), zapisana w stałoprzecinkowym formacie (* 4096)
+void createColorMatrix(Settings *userSettings, int colorMatrix[3][3])
+{
+    float neutral[3], light[3], gains[3];
+    blackBodyColor(WHITE_BALANCE_NEUTRAL, neutral);
+    blackBodyColor(userSettings->whiteBalance, light);
+
+    for(int i = 0; i <= 2; i++)
     {
-        heightFloat = (float)appData->image.rows * ((float)appData->imageSizeWidth / (float)appData->image.cols);
-        if(heightFloat > (float)appData->imageSizeHeight)
+        gains[i] = neutral[i] / max(1.0f, light[i]);
+    }
+    float greenGain = gains[GREEN];
+    for(int i = 0; i <= 2; i++)
+    {
+        gains[i] /= greenGain;
+    }
+    gains[GREEN] *= 1.0f - TINT_RANGE * userSettings->tint;
+
+    for(int output = 0; output <= 2; output++)
+    {
+        for(int input = 0; input <= 2; input++)
         {
-            heightFloat = (float)appData->imageSizeHeight;
+            colorMatrix[output][input] = lroundf(4096.0f * userSettings->channelMixer[output][input] * gains[input]);
         }
-        widthFloat = (float)appData->image.cols * (heightFloat / (float)appData->image.rows);
     }
-    else
+}
+
+// Mnożenie koloru przez macierz na liczbach całkowitych
+Vec3b channelMixer(Vec3b colorVector, const int colorMatrix[3][3])
+{
+    int red = colorVector[RED], green = colorVector[GREEN], blue = colorVector[BLUE];
+
+    for(int i = 0; i <= 2; i++)
+    {
+        colorVector[i] = valueInRange((colorMatrix[i][RED] * red + colorMatrix[i][GREEN] * green + colorMatrix[i][BLUE] * blue + 2048) >> 12);
+    }
+    return colorVector;
+}
+
+// Macierz (jeśli podana) i wzmocnienie winiety (* 256) zastosowane do wartości liniowych, z jednym przejściem tam i z powrotem
+Vec3b gainLinear(Vec3b colorVector, const int colorMatrix[3][3], int vignetteGain, const LinearTables *tables)
+{
+    int light[3];
+    for(int i = 0; i <= 2; i++)
+    {
+        light[i] = tables->toLinear[colorVector[i]];
+    }
+
+    if(colorMatrix != NULL)
+    {
+        int red = light[RED], green = light[GREEN], blue = light[BLUE];
+        for(int i = 0; i <= 2; i++)
+        {
+            light[i] = ((int64_t)colorMatrix[i][RED] * red + (int64_t)colorMatrix[i][GREEN] * green + (int64_t)colorMatrix[i][BLUE] * blue + 2048) >> 12;
+        }
+    }
+
+    for(int i = 0; i <= 2; i++)
+    {
+        colorVector[i] = linearToValue(tables, min(light[i], LINEAR_MAX) * vignetteGain >> 8);
+    }
+    return colorVector;
+}
+
+// Wszystkie tablice potrzebne włączonym operacjom, origin i frameSize to położenie renderowanego wycinka w kadrze
+void createPixelTables(Settings *userSettings, const Settings *defaultSettings, int cols, int rows, Point origin, Size frameSize, PixelTables *pixelTables)
+{
+    int operations = activePixelOperations(userSettings, defaultSettings);
+
+    if(operations & PIXEL_OPERATION_VIGNETTE)
+        createVignetteTables(userSettings->vignette, cols, rows, origin, frameSize, pixelTables->vignetteColumns, pixelTables->vignetteRows);
+    if(operations & PIXEL_OPERATION_HSL)
+        createHslTables(userSettings, pixelTables->hslSaturation, pixelTables->hslLuminance);
+    if(operations & PIXEL_OPERATION_MATRIX)
+        createColorMatrix(userSettings, pixelTables->colorMatrix);
+}
+
+// Wersja pętli dla konkretnego zbioru operacji, w pętli nie ma warunków zależnych od ustawień
+// Wiersz y obrazu odpowiada wierszowi tableRowOffset + y w tablicach pixelTables
+template<int operations>
+void transformImageRows(Mat image, int rowStart, int rowEnd, Settings *userSettings, int *lookUpTable, float *tonesLookUpTable, Mat clarityBlur, const PixelTables *pixelTables, int tableRowOffset)
+{
+    const int *vignetteColumns = (operations & PIXEL_OPERATION_VIGNETTE) ? &pixelTables->vignetteColumns[0] : NULL;
+    const int *hslSaturation = (operations & PIXEL_OPERATION_HSL) ? &pixelTables->hslSaturation[0] : NULL;
+    const int *hslLuminance = (operations & PIXEL_OPERATION_HSL) ? &pixelTables->hslLuminance[0] : NULL;
+    const int *reciprocals = (operations & PIXEL_OPERATION_HSL) ? hueReciprocals() : NULL;
+    const LinearTables *linear = (operations & PIXEL_OPERATION_LINEAR) ? linearTables() : NULL;
+
+    for(int y = rowStart; y < rowEnd; y++)
+    {
+        Vec3b *imageRow = image.ptr<Vec3b>(y);
+        const uchar *clarityBlurRow = (operations & PIXEL_OPERATION_CLARITY) ? clarityBlur.ptr<uchar>(y) : NULL;
+        int vignetteRow = (operations & PIXEL_OPERATION_VIGNETTE) ? pixelTables->vignetteRows[tableRowOffset + y] : 0;
+
+        for(int x = 0; x < image.cols; x++)
+        {
+            Vec3b color = imageRow[x];
+            int pixelLuminance = (color[RED] * RED_LUMINANCE) + (color[GREEN] * GREEN_LUMINANCE) + (color[BLUE] * BLUE_LUMINANCE);
+
+            if(operations & PIXEL_OPERATION_CLARITY)
+                color = clarity(color, userSettings->clarity, &pixelLuminance, clarityBlurRow[x]);
+
+            // Macierz (balans bieli, mikser) i winieta dopiero po klarowności, bo rozmycie liczone jest ze zdjęcia przed nimi
+            // (inaczej szczegóły zawierałyby zmianę jasności wprowadzoną przez macierz lub winietę)
+            if(operations & (PIXEL_OPERATION_MATRIX | PIXEL_OPERATION_VIGNETTE))
+            {
+                int vignetteGain = (operations & PIXEL_OPERATION_VIGNETTE) ? (vignetteColumns[x] * vignetteRow) >> 8 : 256;
+                if(operations & PIXEL_OPERATION_LINEAR)
+                {
+                    color = gainLinear(color, (operations & PIXEL_OPERATION_MATRIX) ? pixelTables->colorMatrix : NULL, vignetteGain, linear);
+                }
+                else
+                {
+                    if(operations & PIXEL_OPERATION_MATRIX)
+                        color = channelMixer(color, pixelTables->colorMatrix);
+                    if(operations & PIXEL_OPERATION_VIGNETTE)
+                    {
+                        for(int i = 0; i <= 2; i++)
+                        {
+                            color[i] = min(255, (color[i] * vignetteGain + 128) >> 8);
+                        }
+                    }
+                }
+                pixelLuminance = (color[RED] * RED_LUMINANCE) + (color[GREEN] * GREEN_LUMINANCE) + (color[BLUE] * BLUE_LUMINANCE);
+            }
+            if((operations & PIXEL_OPERATION_SATURATION) && (operations & PIXEL_OPERATION_LINEAR))
+                color = saturationLinear(color, userSettings->saturation, linear);
+            else if(operations & PIXEL_OPERATION_SATURATION)
+                color = saturation(color, userSettings->saturation, &pixelLuminance);
+            if(operations & PIXEL_OPERATION_HSL)
+                color = hueSaturationLuminance(color, hslSaturation, hslLuminance, reciprocals, &pixelLuminance);
+            if(operations & PIXEL_OPERATION_TONES)
+                color = shadowsMidtonesHihlights(color, tonesLookUpTable, &pixelLuminance);
+
+            for(int i = 0; i <= 2; i++)
+            {
+                color[i] = *((lookUpTable + color[i] * 3) + i);
+            }
+
+            imageRow[x] = color;
+        }
+    }
+}
+
+typedef void (*TransformRowsKernel)(Mat, int, int, Settings *, int *, float *, Mat, const PixelTables *, int);
+
+// Tablica wskaźników na wszystkie warianty pętli, indeksowana maską operacji
+template<int... operations>
+TransformRowsKernel selectTransformRowsKernel(int activeOperations, integer_sequence<int, operations...>)
+{
+    static const TransformRowsKernel kernels[] = { &transformImageRows<operations>... };
+    return kernels[activeOperations];
+}
+
+// Zliczanie już przetworzonych wierszy do histogramów, wiersze są wtedy jeszcze w cache
+void accumulateScopesRows(Mat image, int rowStart, int rowEnd, Scopes *scopes, int *waveformColumn)
+{
+    for(int y = rowStart; y < rowEnd; y++)
+    {
+        const Vec3b *imageRow = image.ptr<Vec3b>(y);
+
+        for(int x = 0; x < image.cols; x++)
+        {
+            Vec3b color = imageRow[x];
+            int pixelLuminance = (color[RED] * RED_LUMINANCE) + (color[GREEN] * GREEN_LUMINANCE) + (color[BLUE] * BLUE_LUMINANCE);
+
+            scopes->histogram[RED][color[RED]]++;
+            scopes->histogram[GREEN][color[GREEN]]++;
+            scopes->histogram[BLUE][color[BLUE]]++;
+            scopes->waveform[waveformColumn[x]][pixelLuminance]++;
+        }
+    }
+}
+
+// Składniki maski liczone raz na kolumnę i raz na wiersz (współrzędne środków pikseli względem całego kadru),
+// dla gradientu liniowego ich suma to położenie na odcinku od punktu początkowego (0) do końcowego (1),
+// dla radialnego to kwadrat odległości od środka w jednostkach promieni elipsy
+void createMaskTerms(GradientMask *mask, int cols, int rows, Point origin, Size frameSize, vector<float> &maskColumns, vector<float> &maskRows)
+{
+    maskColumns.resize(cols);
+    maskRows.resize(rows);
+
+    for(int x = 0; x < cols; x++)
+    {
+        float frameX = (origin.x + x + 0.5f) / frameSize.width;
+        if(mask->type == MASK_LINEAR)
+        {
+            float directionX = mask->parameters[2] - mask->parameters[0], directionY = mask->parameters[3] - mask->parameters[1];
+            maskColumns[x] = (frameX - mask->parameters[0]) * directionX / (directionX * directionX + directionY * directionY);
+        }
+        else
+        {
+            float distance = (frameX - mask->parameters[0]) / mask->parameters[2];
+            maskColumns[x] = distance * distance;
+        }
+    }
+
+    for(int y = 0; y < rows; y++)
+    {
+        float frameY = (origin.y + y + 0.5f) / frameSize.height;
+        if(mask->type == MASK_LINEAR)
+        {
+            float directionX = mask->parameters[2] - mask->parameters[0], directionY = mask->parameters[3] - mask->parameters[1];
+            maskRows[y] = (frameY - mask->parameters[1]) * directionY / (directionX * directionX + directionY * directionY);
+        }
+        else
+        {
+            float distance = (frameY - mask->parameters[1]) / mask->parameters[3];
+            maskRows[y] = distance * distance;
+        }
+    }
+}
+
+// Mieszanie wierszy z pasmem przetworzonym drugą transformacją: wagi wiersza liczone są do bufora (wagi 0-256),
+// a samo mieszanie to pętla na liczbach całkowitych bez rozgałęzień, którą kompilator wektoryzuje
+void blendMaskRows(Mat image, Mat maskBand, int rowStart, int rowEnd, GradientMask *mask, const float *maskColumns, const float *maskRows)
+{
+    vector<int> weights(image.cols);
+    float feather = mask->type == MASK_RADIAL ? mask->parameters[4] : 1.0f;
+
+    for(int y = rowStart; y < rowEnd; y++)
+    {
+        float rowTerm = maskRows[y];
+
+        if(mask->type == MASK_LINEAR)
+        {
+            for(int x = 0; x < image.cols; x++)
+            {
+                weights[x] = 256.0f * (1.0f - min(1.0f, max(0.0f, maskColumns[x] + rowTerm))) + 0.5f;
+            }
+        }
+        else
+        {
+            for(int x = 0; x < image.cols; x++)
+            {
+                weights[x] = 256.0f * min(1.0f, max(0.0f, (1.0f - sqrtf(maskColumns[x] + rowTerm)) / feather)) + 0.5f;
+            }
+        }
+        if(mask->invert)
+        {
+            for(int x = 0; x < image.cols; x++)
+            {
+                weights[x] = 256 - weights[x];
+            }
+        }
+
+        uchar *imageRow = image.ptr<uchar>(y);
+        const uchar *maskRow = maskBand.ptr<uchar>(y - rowStart);
+        for(int x = 0; x < image.cols; x++)
+        {
+            int weight = weights[x];
+            for(int i = 0; i <= 2; i++)
+            {
+                int base = imageRow[x * 3 + i];
+                imageRow[x * 3 + i] = base + (((maskRow[x * 3 + i] - base) * weight) >> 8);
+            }
+        }
+    }
+}
+
+// Zdjęcie dzielone jest na pasma po RENDER_BAND_ROWS wierszy przetwarzane równolegle
+// Jeśli podano scopes, każde pasmo zlicza histogramy do własnej kopii, które są sumowane dopiero po zakończeniu wszystkich wątków
+// Jeśli podano progress, po każdym paśmie zwiększana jest liczba gotowych wierszy, a po przerwaniu pozostałe pasma są pomijane (zwracane jest false)
+// Z maską każde pasmo jest kopiowane do bufora, przetwarzane drugą transformacją i mieszane z wynikiem, origin i frameSize to położenie image w kadrze
+// (od nich zależą też tablice winiety, więc wycinek renderowany z przybliżeniem ma taką samą winietę jak całe zdjęcie)
+bool transformImage(Mat image, Settings *userSettings, const Settings *defaultSettings, int *lookUpTable, float *tonesLookUpTable, Mat clarityBlur, Scopes *scopes, RenderProgress *progress, Point origin, Size frameSize)
+{
+    int bands = (image.rows + RENDER_BAND_ROWS - 1) / RENDER_BAND_ROWS;
+    TransformRowsKernel transformRows = selectTransformRowsKernel(activePixelOperations(userSettings, defaultSettings), make_integer_sequence<int, 1 << PIXEL_OPERATIONS_COUNT>());
+    vector<Scopes> partialScopes(scopes != NULL ? bands : 0);
+    vector<int> waveformColumn(scopes != NULL ? image.cols : 0);
+
+    for(int x = 0; x < (int)waveformColumn.size(); x++)
+    {
+        waveformColumn[x] = x * WAVEFORM_COLUMNS / image.cols;
+    }
+
+    PixelTables pixelTables;
+    createPixelTables(userSettings, defaultSettings, image.cols, image.rows, origin, frameSize, &pixelTables);
+
+    bool masked = userSettings->mask.type != MASK_NONE && userSettings->maskGrade;
+    Settings maskSettings;
+    int maskLookUpTable[256][3];
+    float maskTonesLookUpTable[256];
+    TransformRowsKernel maskTransformRows = NULL;
+    vector<float> maskColumns, maskRows;
+    PixelTables maskPixelTables;
+    if(masked)
+    {
+        maskSettings = *userSettings->maskGrade;
+        createLookUpTable(&maskSettings, defaultSettings, &maskLookUpTable[0][0]);
+        createTonesLookUpTable(&maskSettings, maskTonesLookUpTable);
+        maskTransformRows = selectTransformRowsKernel(activePixelOperations(&maskSettings, defaultSettings), make_integer_sequence<int, 1 << PIXEL_OPERATIONS_COUNT>());
+        createMaskTerms(&userSettings->mask, image.cols, image.rows, origin, frameSize, maskColumns, maskRows);
+        createPixelTables(&maskSettings, defaultSettings, image.cols, image.rows, origin, frameSize, &maskPixelTables);
+    }
+
+    if(progress != NULL)
+    {
+        progress->rowsDone = 0;
+        progress->rowsTotal = image.rows;
+    }
+
+    parallel_for_(Range(0, bands), [&](const Range &range)
+    {
+        for(int band = range.start; band < range.end; band++)
+        {
+            if(progress != NULL && progress->cancelled)
+                return;
+
+            int rowStart = band * RENDER_BAND_ROWS;
+            int rowEnd = min(rowStart + RENDER_BAND_ROWS, image.rows);
+
+            Mat maskBand;
+            if(masked)
+            {
+                maskBand = image.rowRange(rowStart, rowEnd).clone();
+                maskTransformRows(maskBand, 0, rowEnd - rowStart, &maskSettings, &maskLookUpTable[0][0], maskTonesLookUpTable, clarityBlur.empty() ? clarityBlur : clarityBlur.rowRange(rowStart, rowEnd), &maskPixelTables, rowStart);
+            }
+
+            transformRows(image, rowStart, rowEnd, userSettings, lookUpTable, tonesLookUpTable, clarityBlur, &pixelTables, 0);
+            if(masked)
+                blendMaskRows(image, maskBand, rowStart, rowEnd, &userSettings->mask, &maskColumns[0], &maskRows[0]);
+            if(scopes != NULL)
+                accumulateScopesRows(image, rowStart, rowEnd, &partialScopes[band], &waveformColumn[0]);
+
+            if(progress != NULL)
+                progress->rowsDone += rowEnd - rowStart;
+        }
+    });
+
+    if(progress != NULL && progress->cancelled)
+    {
+        return false;
+    }
+
+    if(scopes != NULL)
+    {
+        *scopes = Scopes();
+        for(int band = 0; band < bands; band++)
+        {
+            for(int level = 0; level < 256; level++)
+            {
+                for(int i = 0; i <= 2; i++)
+                {
+                    scopes->histogram[i][level] += partialScopes[band].histogram[i][level];
+                }
+                for(int column = 0; column < WAVEFORM_COLUMNS; column++)
+                {
+                    scopes->waveform[column][level] += partialScopes[band].waveform[column][level];
+                }
+            }
+        }
+    }
+    return true;
+}
+
+
+// ------------------------------------------------------
+//  FUNKCJE AUTOMATYCZNIE DOBIERAJĄCE USTAWIENIA ZDJĘCIA
+// ------------------------------------------------------
+
+// Histogram luminacji liczony równolegle co step-ty wiersz i kolumnę, każde pasmo ma własny histogram
+void createLuminanceHistogram(Mat image, unsigned int *histogram)
+{
+    int step = max(1, (int)sqrt((double)image.rows * image.cols / AUTO_SAMPLE_PIXELS));
+    int sampledRows = (image.rows + step - 1) / step;
+    int bands = (sampledRows + RENDER_BAND_ROWS - 1) / RENDER_BAND_ROWS;
+    vector<unsigned int> partialHistograms(bands * 256, 0);
+
+    parallel_for_(Range(0, bands), [&](const Range &range)
+    {
+        for(int band = range.start; band < range.end; band++)
+        {
+            unsigned int *partialHistogram = &partialHistograms[band * 256];
+
+            for(int sampledRow = band * RENDER_BAND_ROWS; sampledRow < min((band + 1) * RENDER_BAND_ROWS, sampledRows); sampledRow++)
+            {
+                const Vec3b *imageRow = image.ptr<Vec3b>(sampledRow * step);
+
+                for(int x = 0; x < image.cols; x += step)
+                {
+                    int pixelLuminance = (imageRow[x][RED] * RED_LUMINANCE) + (imageRow[x][GREEN] * GREEN_LUMINANCE) + (imageRow[x][BLUE] * BLUE_LUMINANCE);
+                    partialHistogram[pixelLuminance]++;
+                }
+            }
+        }
+    });
+
+    for(int level = 0; level < 256; level++)
+    {
+        histogram[level] = 0;
+        for(int band = 0; band < bands; band++)
+        {
+            histogram[level] += partialHistograms[band * 256 + level];
+        }
+    }
+}
+
+// Najniższa wartość luminacji, poniżej której leży podana liczba promili pikseli
+int histogramPercentile(unsigned int *histogram, int permille)
+{
+    unsigned long long total = 0;
+    for(int level = 0; level < 256; level++)
+    {
+        total += histogram[level];
+    }
+
+    unsigned long long threshold = total * permille / 1000;
+    unsigned long long sum = 0;
+    for(int level = 0; level < 256; level++)
+    {
+        sum += histogram[level];
+        if(sum > threshold)
+        {
+            return level;
+        }
+    }
+    return 255;
+}
+
+// Dobór kontrastu (rozciągnięcie zakresu czerń-biel), ekspozycji (mediana do średniej szarości) oraz cieni i prześwietleń
+// na podstawie rozkładu luminacji, pozostałe ustawienia nie są zmieniane
+// Jeśli podano defaultSettings, zmieniane są tylko wartości równe domyślnym, a ustawione wcześniej (flagą lub w presecie)
+// zostają, np. ekspozycja dobierana jest wtedy do kontrastu podanego przez użytkownika
+void autoAdjustSettings(Mat image, Settings *userSettings, const Settings *defaultSettings)
+{
+    bool adjustContrast = defaultSettings == NULL || userSettings->contrast == defaultSettings->contrast;
+    bool adjustExposure = defaultSettings == NULL || userSettings->exposure == defaultSettings->exposure;
+    bool adjustShadows = defaultSettings == NULL || userSettings->shadows == defaultSettings->shadows;
+    bool adjustHighlights = defaultSettings == NULL || userSettings->highlights == defaultSettings->highlights;
+
+    unsigned int histogram[256];
+    createLuminanceHistogram(image, histogram);
+
+    int black = histogramPercentile(histogram, AUTO_BLACK_PERMILLE);
+    int white = histogramPercentile(histogram, AUTO_WHITE_PERMILLE);
+    int median = histogramPercentile(histogram, 500);
+
+    // Odwrócenie wzoru z funkcji contrast() dla współczynnika rozciągającego zakres do 0-255
+    float factor = min(2.0f, max(0.5f, 255.0f / (float)max(1, white - black)));
+    if(adjustContrast)
+    {
+        userSettings->contrast = 259.0 * 255.0 * (factor - 1.0) / (259.0 + 255.0 * factor);
+    }
+    else
+    {
+        factor = (259.0 * (userSettings->contrast + 255.0)) / (255.0 * (259.0 - userSettings->contrast));
+    }
+
+    float medianAfterContrast = min(255.0f, max(1.0f, factor * (median - 128) + 128));
+    if(adjustExposure)
+    {
+        userSettings->exposure = min(2.0f, max(-2.0f, (float)log2(AUTO_TARGET_MEDIAN / medianAfterContrast)));
+    }
+
+    // Cienie rozjaśniane, a prześwietlenia przyciemniane proporcjonalnie do udziału pikseli w skrajnej ćwiartce zakresu
+    unsigned long long total = 0, dark = 0, bright = 0;
+    for(int level = 0; level < 256; level++)
+    {
+        total += histogram[level];
+        if(level < 64) dark += histogram[level];
+        if(level >= 192) bright += histogram[level];
+    }
+    float darkFraction = total > 0 ? (float)dark / total : 0.0;
+    float brightFraction = total > 0 ? (float)bright / total : 0.0;
+    if(adjustShadows)
+    {
+        userSettings->shadows = darkFraction > 0.25 ? min(0.5f, darkFraction - 0.25f) : 0.0;
+    }
+    if(adjustHighlights)
+    {
+        userSettings->highlights = brightFraction > 0.25 ? -min(0.5f, brightFraction - 0.25f) : 0.0;
+    }
+
+    cout << "Automatyczne ustawienia: kontrast " << userSettings->contrast << ", ekspozycja " << userSettings->exposure << ", cienie " << userSettings->shadows << ", prześwietlenia " << userSettings->highlights << endl;
+}
+
+
+// -----------------------------------------------------
+//  FUNKCJE OBSŁUGUJĄCE PAMIĘĆ PODRĘCZNĄ ZDEKODOWANYCH ZDJĘĆ
+// -----------------------------------------------------
+
+// Skrót FNV-1a, kolejne wywołania można łączyć podając poprzedni wynik jako hash
+uint64_t hashBytes(uint64_t hash, const void *data, size_t size)
+{
+    for(size_t i = 0; i < size; i++)
+    {
+        hash = (hash ^ ((const unsigned char *)data)[i]) * 1099511628211ULL;
+    }
+    return hash;
+}
+
+// Skrót ustawień wpływających na wygląd zdjęcia (bez ścieżek i flag trybu pracy)
+uint64_t settingsHash(const Settings *settings)
+{
+    uint64_t hash = 14695981039346656037ULL;
+
+    hash = hashBytes(hash, &settings->contrast, sizeof(settings->contrast));
+    hash = hashBytes(hash, &settings->brightness, sizeof(settings->brightness));
+    hash = hashBytes(hash, &settings->exposure, sizeof(settings->exposure));
+    hash = hashBytes(hash, &settings->saturation, sizeof(settings->saturation));
+    hash = hashBytes(hash, &settings->colorTemperature, sizeof(settings->colorTemperature));
+    hash = hashBytes(hash, settings->hue, sizeof(settings->hue));
+    hash = hashBytes(hash, &settings->lift, sizeof(settings->lift));
+    hash = hashBytes(hash, &settings->gamma, sizeof(settings->gamma));
+    hash = hashBytes(hash, &settings->gain, sizeof(settings->gain));
+    hash = hashBytes(hash, &settings->shadows, sizeof(settings->shadows));
+    hash = hashBytes(hash, &settings->midtones, sizeof(settings->midtones));
+    hash = hashBytes(hash, &settings->highlights, sizeof(settings->highlights));
+    hash = hashBytes(hash, &settings->clarity, sizeof(settings->clarity));
+    hash = hashBytes(hash, &settings->vignette, sizeof(settings->vignette));
+    hash = hashBytes(hash, &settings->denoise, sizeof(settings->denoise));
+    hash = hashBytes(hash, settings->hslSaturation, sizeof(settings->hslSaturation));
+    hash = hashBytes(hash, settings->hslLuminance, sizeof(settings->hslLuminance));
+    hash = hashBytes(hash, &settings->whiteBalance, sizeof(settings->whiteBalance));
+    hash = hashBytes(hash, &settings->tint, sizeof(settings->tint));
+    hash = hashBytes(hash, settings->channelMixer, sizeof(settings->channelMixer));
+    hash = hashBytes(hash, &settings->linearLight, sizeof(settings->linearLight));
+    hash = hashBytes(hash, settings->curves, sizeof(settings->curves));
+    if(settings->mask.type != MASK_NONE && settings->maskGrade)
+    {
+        uint64_t maskGradeHash = settingsHash(settings->maskGrade.get());
+        hash = hashBytes(hash, &settings->mask.type, sizeof(settings->mask.type));
+        hash = hashBytes(hash, settings->mask.parameters, sizeof(settings->mask.parameters));
+        hash = hashBytes(hash, &settings->mask.invert, sizeof(settings->mask.invert));
+        hash = hashBytes(hash, &maskGradeHash, sizeof(maskGradeHash));
+    }
+
+    return hash;
+}
+
+string cacheDirectory()
+{
+    const char *xdgCache = getenv("XDG_CACHE_HOME");
+    const char *home = getenv("HOME");
+    string base = xdgCache != NULL ? xdgCache : (home != NULL ? string(home) + "/.cache" : "/tmp");
+
+    mkdir(base.c_str(), 0755);
+    mkdir((base + "/" + CACHE_DIRECTORY).c_str(), 0755);
+    return base + "/" + CACHE_DIRECTORY;
+}
+
+// Nazwa pliku to skrót FNV-1a klucza (ścieżka po realpath, urządzenie, i-węzeł, czas modyfikacji i rozmiar),
+// więc ten sam plik podany inną ścieżką trafia na ten sam wpis, a zmieniony plik (także w tej samej sekundzie) na nowy
+bool cachePath(string *imageName, string *path, CacheKey *key)
+{
+    struct stat fileStat;
+    char resolvedPath[PATH_MAX];
+    if(stat(imageName->c_str(), &fileStat) != 0 || realpath(imageName->c_str(), resolvedPath) == NULL)
+    {
+        return false;
+    }
+
+    memset(key, 0, sizeof(CacheKey));
+    strncpy(key->path, resolvedPath, sizeof(key->path) - 1);
+    key->device = fileStat.st_dev;
+    key->inode = fileStat.st_ino;
+    key->modifiedSeconds = fileStat.st_mtim.tv_sec;
+    key->modifiedNanoseconds = fileStat.st_mtim.tv_nsec;
+    key->size = fileStat.st_size;
+    uint64_t hash = hashBytes(14695981039346656037ULL, key, sizeof(CacheKey));
+
+    char hashText[17];
+    snprintf(hashText, sizeof(hashText), "%016llx", (unsigned long long)hash);
+    *path = cacheDirectory() + "/" + hashText + CACHE_EXTENSION;
+    return true;
+}
+
+// Mapowanie pliku z pamięci podręcznej bez kopiowania, levels wskazują bezpośrednio na zmapowane dane
+bool loadFromCache(string *imageName, vector<Mat> &levels, shared_ptr<ImageCache> &imageCache)
+{
+    string path;
+    CacheKey key;
+    if(!cachePath(imageName, &path, &key))
+    {
+        return false;
+    }
+
+    int file = open(path.c_str(), O_RDONLY);
+    if(file < 0)
+    {
+        return false;
+    }
+
+    struct stat fileStat;
+    if(fstat(file, &fileStat) != 0 || (size_t)fileStat.st_size < sizeof(CacheHeader))
+    {
+        close(file);
+        return false;
+    }
+
+    // MAP_PRIVATE, żeby ewentualny zapis do Mat nie zmienił pliku
+    void *data = mmap(NULL, fileStat.st_size, PROT_READ | PROT_WRITE, MAP_PRIVATE, file, 0);
+    close(file);
+    if(data == MAP_FAILED)
+    {
+        return false;
+    }
+
+    shared_ptr<ImageCache> mapping = make_shared<ImageCache>(data, (size_t)fileStat.st_size);
+    CacheHeader *header = (CacheHeader *)data;
+    if(memcmp(header->magic, CACHE_MAGIC, 8) != 0 || header->version != CACHE_VERSION || memcmp(&header->key, &key, sizeof(CacheKey)) != 0 ||
+       header->levels == 0 || header->levels > CACHE_MAX_LEVELS)
+    {
+        return false;
+    }
+
+    levels.clear();
+    for(uint32_t level = 0; level < header->levels; level++)
+    {
+        if(header->offset[level] + (uint64_t)header->rows[level] * header->cols[level] * 3 > (uint64_t)fileStat.st_size)
+        {
+            levels.clear();
+            return false;
+        }
+        levels.push_back(Mat(header->rows[level], header->cols[level], CV_8UC3, (uchar *)data + header->offset[level]));
+    }
+
+    // Czas modyfikacji wpisu służy jako czas ostatniego użycia przy usuwaniu najstarszych wpisów
+    utime(path.c_str(), NULL);
+    imageCache = mapping;
+    return true;
+}
+
+// Usuwanie najdawniej używanych wpisów, dopóki pamięć podręczna przekracza CACHE_MAX_BYTES
+void trimCache()
+{
+    string directory = cacheDirectory();
+    DIR *cacheDir = opendir(directory.c_str());
+    if(cacheDir == NULL)
+    {
+        return;
+    }
+
+    vector<pair<time_t, pair<off_t, string>>> entries;
+    off_t totalSize = 0;
+    struct dirent *entry;
+    while((entry = readdir(cacheDir)) != NULL)
+    {
+        string name = entry->d_name;
+        struct stat fileStat;
+        if(name.size() > strlen(CACHE_EXTENSION) && name.compare(name.size() - strlen(CACHE_EXTENSION), string::npos, CACHE_EXTENSION) == 0 && stat((directory + "/" + name).c_str(), &fileStat) == 0)
+        {
+            entries.push_back(make_pair(fileStat.st_mtime, make_pair(fileStat.st_size, directory + "/" + name)));
+            totalSize += fileStat.st_size;
+        }
+    }
+    closedir(cacheDir);
+
+    sort(entries.begin(), entries.end());
+    for(size_t i = 0; i < entries.size() && totalSize > CACHE_MAX_BYTES; i++)
+    {
+        unlink(entries[i].second.second.c_str());
+        totalSize -= entries[i].second.first;
+    }
+}
+
+// Zapis do pliku tymczasowego i zmiana nazwy, żeby inny proces nigdy nie zmapował niepełnego wpisu
+void saveToCache(string *imageName, vector<Mat> levels)
+{
+    string path;
+    CacheKey key;
+    if(!cachePath(imageName, &path, &key) || levels.size() == 0 || levels.size() > CACHE_MAX_LEVELS)
+    {
+        return;
+    }
+
+    CacheHeader header;
+    memset(&header, 0, sizeof(header));
+    memcpy(header.magic, CACHE_MAGIC, 8);
+    header.version = CACHE_VERSION;
+    header.key = key;
+    header.levels = levels.size();
+
+    uint64_t offset = (sizeof(CacheHeader) + CACHE_ALIGNMENT - 1) / CACHE_ALIGNMENT * CACHE_ALIGNMENT;
+    for(size_t level = 0; level < levels.size(); level++)
+    {
+        header.rows[level] = levels[level].rows;
+        header.cols[level] = levels[level].cols;
+        header.offset[level] = offset;
+        offset += ((uint64_t)levels[level].rows * levels[level].cols * 3 + CACHE_ALIGNMENT - 1) / CACHE_ALIGNMENT * CACHE_ALIGNMENT;
+    }
+
+    string temporaryPath = path + ".tmp" + to_string((long long)getpid());
+    int file = open(temporaryPath.c_str(), O_WRONLY | O_CREAT | O_TRUNC, 0644);
+    if(file < 0)
+    {
+        return;
+    }
+
+    bool success = ftruncate(file, offset) == 0 && pwrite(file, &header, sizeof(header), 0) == (ssize_t)sizeof(header);
+    for(size_t level = 0; level < levels.size() && success; level++)
+    {
+        size_t rowSize = (size_t)levels[level].cols * 3;
+        for(int y = 0; y < levels[level].rows && success; y++)
+        {
+            success = pwrite(file, levels[level].ptr<uchar>(y), rowSize, header.offset[level] + (uint64_t)y * rowSize) == (ssize_t)rowSize;
+        }
+    }
+    close(file);
+
+    if(!success || rename(temporaryPath.c_str(), path.c_str()) != 0)
+    {
+        unlink(temporaryPath.c_str());
+        return;
+    }
+
+    trimCache();
+}
+
+
+// -----------------------------------------------
+//  FUNKCJE POZWALAJĄCE NA TRASFORMOWANIE ZDJĘCIA
+// -----------------------------------------------
+
+bool openFile(Mat &image, Mat &imageOriginal, string *imageName)
+{
+    // Jeśli zdjęcie jest w pamięci podręcznej, kopiowane są zmapowane piksele zamiast dekodowania
+    vector<Mat> cachedLevels;
+    shared_ptr<ImageCache> imageCache;
+    if(loadFromCache(imageName, cachedLevels, imageCache))
+    {
+        image = cachedLevels[0].clone();
+        imageOriginal = image.clone();
+        return true;
+    }
+
+    image = imread(samples::findFile(*imageName, false, true), IMREAD_COLOR);
+    if(image.empty())
+    {
+        cout <<  "Nie można otworzyć lub znaleźć pliku o nazwie " << *imageName << "!" << endl ;
+        return false;
+    }
+    imageOriginal = image.clone();
+    return true;
+}
+
+// Pomniejszona kopia zdjęcia, na której interfejs wykonuje podgląd zmian (pełna rozdzielczość tylko przy eksporcie)
+void createPreview(Mat imageOriginal, Mat &imagePreview)
+{
+    int longerSide = max(imageOriginal.rows, imageOriginal.cols);
+
+    if(longerSide <= PREVIEW_MAX_SIZE)
+    {
+        imagePreview = imageOriginal;
+    }
+    else
+    {
+        float scale = (float)PREVIEW_MAX_SIZE / (float)longerSide;
+        resize(imageOriginal, imagePreview, Size(max(1, (int)(imageOriginal.cols * scale)), max(1, (int)(imageOriginal.rows * scale))), 0, 0, INTER_AREA);
+    }
+}
+
+// Kolejne poziomy to zdjęcie pomniejszone dwukrotnie względem poprzedniego, aż do wielkości podglądu
+void createPyramid(Mat imageOriginal, vector<Mat> &imagePyramid)
+{
+    imagePyramid.clear();
+    imagePyramid.push_back(imageOriginal);
+
+    while(max(imagePyramid.back().rows, imagePyramid.back().cols) > PREVIEW_MAX_SIZE)
+    {
+        Mat level;
+        resize(imagePyramid.back(), level, Size(max(1, imagePyramid.back().cols / 2), max(1, imagePyramid.back().rows / 2)), 0, 0, INTER_AREA);
+        imagePyramid.push_back(level);
+    }
+}
+
+string fileExtension(string *path)
+{
+    size_t dot = path->rfind('.');
+    string extension = dot == string::npos ? "" : path->substr(dot + 1);
+
+    for(size_t i = 0; i < extension.size(); i++)
+    {
+        extension[i] = tolower(extension[i]);
+    }
+    return extension;
+}
+
+// Parametry imwrite dla profilu eksportu: "fast" (najkrótszy zapis), "archive" (bez strat lub najwyższa jakość), "web" (mały plik)
+// Pusty profil zostawia domyślne parametry OpenCV
+bool exportParameters(string *exportProfile, string *outputPath, vector<int> &parameters)
+{
+    string extension = fileExtension(outputPath);
+    parameters.clear();
+
+    if(exportProfile->size() == 0)
+    {
+        return true;
+    }
+    if(*exportProfile != "fast" && *exportProfile != "archive" && *exportProfile != "web")
+    {
+        cout << "Nieznany profil eksportu " << *exportProfile << "!" << endl;
+        return false;
+    }
+
+    bool fast = *exportProfile == "fast", archive = *exportProfile == "archive";
+
+    if(extension == "png")
+    {
+        parameters.push_back(IMWRITE_PNG_COMPRESSION);
+        parameters.push_back(fast ? 1 : (archive ? 9 : 6));
+        parameters.push_back(IMWRITE_PNG_STRATEGY);
+        parameters.push_back(fast ? IMWRITE_PNG_STRATEGY_RLE : (archive ? IMWRITE_PNG_STRATEGY_DEFAULT : IMWRITE_PNG_STRATEGY_FILTERED));
+    }
+    else if(extension == "jpg" || extension == "jpeg")
+    {
+        parameters.push_back(IMWRITE_JPEG_QUALITY);
+        parameters.push_back(fast ? 90 : (archive ? 100 : 85));
+        parameters.push_back(IMWRITE_JPEG_OPTIMIZE);
+        parameters.push_back(fast ? 0 : 1);
+        parameters.push_back(IMWRITE_JPEG_PROGRESSIVE);
+        parameters.push_back(!fast && !archive ? 1 : 0);
+#if HAVE_JPEG_SAMPLING_FACTOR
+        parameters.push_back(IMWRITE_JPEG_SAMPLING_FACTOR);
+        parameters.push_back(archive ? IMWRITE_JPEG_SAMPLING_FACTOR_444 : IMWRITE_JPEG_SAMPLING_FACTOR_420);
+#endif
+    }
+    else if(extension == "tif" || extension == "tiff")
+    {
+        // 1 - bez kompresji, 5 - LZW (numeracja z libtiff)
+        parameters.push_back(IMWRITE_TIFF_COMPRESSION);
+        parameters.push_back(fast ? 1 : 5);
+    }
+    else if(extension == "webp")
+    {
+        // Jakość powyżej 100 oznacza kompresję bezstratną
+        parameters.push_back(IMWRITE_WEBP_QUALITY);
+        parameters.push_back(fast ? 90 : (archive ? 101 : 80));
+    }
+    return true;
+}
+
+// Wyostrzenie wykonywane jest dopiero tutaj, na zdjęciu już pomniejszonym do rozmiaru pliku
+// Zapis bez komunikatu, używany bezpośrednio przy równoległym zapisie kilku plików
+bool writeFile(Mat image, string *outputPath, string *exportProfile, float sharpenValue)
+{
+    vector<int> parameters;
+
+    if(!image.empty() && exportParameters(exportProfile, outputPath, parameters))
+    {
+        if(sharpenValue > 0.0)
+        {
+            Mat imageSharpened;
+            sharpenImage(image, imageSharpened, sharpenValue);
+            image = imageSharpened;
+        }
+        // Zapis do pliku tymczasowego (z tym samym rozszerzeniem, od którego zależy format) i przeniesienie go na miejsce,
+        // więc inne procesy (np. obserwujące katalog wyjściowy) nigdy nie zobaczą niepełnego pliku
+        // Plik tymczasowy jest ukryty (np. ".wynik.tmp123.jpg"), bo tryb --watch pomija pliki zaczynające się od kropki
+        string extension = fileExtension(outputPath);
+        size_t slash = outputPath->rfind('/');
+        size_t nameStart = slash == string::npos ? 0 : slash + 1;
+        string temporaryPath = outputPath->substr(0, nameStart) + "." + outputPath->substr(nameStart, outputPath->size() - nameStart - extension.size()) + "tmp" + to_string((long long)getpid()) + "." + extension;
+        if(imwrite(temporaryPath, image, parameters) && rename(temporaryPath.c_str(), outputPath->c_str()) == 0)
+        {
+            return true;
+        }
+        unlink(temporaryPath.c_str());
+    }
+    return false;
+}
+
+void printSaveResult(string *outputPath, bool success)
+{
+    if(success)
+    {
+        cout <<  "Plik zapisany w ścieżce " << *outputPath << "!" << endl ;
+    }
+    else
+    {
+        cout <<  "Nie udało się zapisać pliku w ścieżce " << *outputPath << "!" << endl ;
+    }
+}
+
+bool saveFile(Mat image, string *outputPath, string *exportProfile, float sharpenValue)
+{
+    bool success = writeFile(image, outputPath, exportProfile, sharpenValue);
+    printSaveResult(outputPath, success);
+    return success;
+}
+
+// Specyfikacja eksportu to lista plików oddzielonych przecinkami, opcjonalnie z dłuższym bokiem po dwukropku
+// np. "pelne.tif,web.jpg:2048,miniatura.webp:400"
+bool parseExportSpec(string spec, vector<ExportOutput> &outputs)
+{
+    outputs.clear();
+    size_t start = 0;
+
+    while(start <= spec.size())
+    {
+        size_t end = spec.find(',', start);
+        if(end == string::npos)
+        {
+            end = spec.size();
+        }
+
+        ExportOutput output;
+        output.path = spec.substr(start, end - start);
+        size_t colon = output.path.rfind(':');
+        if(colon != string::npos && colon + 1 < output.path.size() && output.path.find_first_not_of("0123456789", colon + 1) == string::npos)
+        {
+            // Sprawdzenie zakresu, stoi rzuciłoby wyjątek przy zbyt długiej liczbie
+            errno = 0;
+            long maxSize = strtol(output.path.c_str() + colon + 1, NULL, 10);
+            if(errno == ERANGE || maxSize < 1 || maxSize > INT_MAX)
+            {
+                cout << "Błędna specyfikacja eksportu!" << endl;
+                return false;
+            }
+            output.maxSize = maxSize;
+            output.path = output.path.substr(0, colon);
+        }
+
+        if(output.path.size() == 0)
+        {
+            cout << "Błędna specyfikacja eksportu!" << endl;
+            return false;
+        }
+        outputs.push_back(output);
+        start = end + 1;
+    }
+    return outputs.size() > 0;
+}
+
+// Mniejsze wersje powstają kaskadowo (każda z poprzedniej, większej), a pliki kodowane są równolegle w osobnych wątkach
+bool exportOutputs(Mat image, vector<ExportOutput> outputs, string *exportProfile, float sharpenValue)
+{
+    vector<int> order(outputs.size());
+    for(size_t i = 0; i < outputs.size(); i++)
+    {
+        order[i] = i;
+    }
+    sort(order.begin(), order.end(), [&](int a, int b)
+    {
+        int sizeA = outputs[a].maxSize > 0 ? outputs[a].maxSize : INT_MAX;
+        int sizeB = outputs[b].maxSize > 0 ? outputs[b].maxSize : INT_MAX;
+        return sizeA > sizeB;
+    });
+
+    vector<Mat> resized(outputs.size());
+    Mat current = image;
+    for(size_t i = 0; i < order.size(); i++)
+    {
+        int maxSize = outputs[order[i]].maxSize;
+        int longerSide = max(current.rows, current.cols);
+
+        if(maxSize > 0 && longerSide > maxSize)
+        {
+            float scale = (float)maxSize / (float)longerSide;
+            Mat smaller;
+            resize(current, smaller, Size(max(1, (int)(current.cols * scale + 0.5)), max(1, (int)(current.rows * scale + 0.5))), 0, 0, INTER_AREA);
+            current = smaller;
+        }
+        resized[order[i]] = current;
+    }
+
+    vector<char> results(outputs.size(), false);
+    vector<thread> encoders;
+    for(size_t i = 0; i < outputs.size(); i++)
+    {
+        encoders.push_back(thread([&, i]()
+        {
+            results[i] = writeFile(resized[i], &outputs[i].path, exportProfile, sharpenValue);
+        }));
+    }
+
+    // Komunikaty wypisywane dopiero po zakończeniu wszystkich wątków, w kolejności ze specyfikacji
+    bool success = true;
+    for(size_t i = 0; i < encoders.size(); i++)
+    {
+        encoders[i].join();
+    }
+    for(size_t i = 0; i < outputs.size(); i++)
+    {
+        printSaveResult(&outputs[i].path, results[i]);
+        success = success && results[i];
+    }
+    return success;
+}
+
+double megapixelsPerSecond(Mat image, double duration)
+{
+    if(duration <= 0.0)
+    {
+        return 0.0;
+    }
+    return (double)image.rows * (double)image.cols / 1000000.0 / duration;
+}
+
+// Transformowanie tylko wycinka region zdjęcia imageOriginal, rozmycie dla klarowności liczone jest z marginesem wokół wycinka
+// Odszumianie wykonywane jest przed transformacją (i przed rozmyciem) na wycinku z marginesem dla obu filtrów
+double updateRegionWithSettings(Mat &image, Mat &imageOriginal, Rect region, Settings *userSettings, const Settings *defaultSettings, int *lookUpTable, float *tonesLookUpTable, Scopes *scopes, RenderProgress *progress)
+{
+    // Benchmarking (czas rzeczywisty, clock() liczyłby czas wszystkich wątków procesora)
+    chrono::steady_clock::time_point start = chrono::steady_clock::now();
+
+    // Transformowanie zdjęcia
+    createLookUpTable(userSettings, defaultSettings, lookUpTable);
+    createTonesLookUpTable(userSettings, tonesLookUpTable);
+
+    bool maskClarity = userSettings->mask.type != MASK_NONE && userSettings->maskGrade && userSettings->maskGrade->clarity != defaultSettings->clarity;
+    bool clarityActive = userSettings->clarity != defaultSettings->clarity || maskClarity;
+
+    // Piksele poza marginesem filtru są tylko jego wejściem, więc imageSource to już dokładnie odszumiony wycinek z marginesem rozmycia
+    Mat imageSource = imageOriginal;
+    Rect sourceRegion = region;
+    if(userSettings->denoise != defaultSettings->denoise)
+    {
+        int radius = denoiseRadius(imageOriginal);
+        Rect denoisedRegion = expandRegion(region, clarityActive ? 3 * clarityRadius(imageOriginal) : 0, imageOriginal.size());
+        Rect regionWithMargin = expandRegion(denoisedRegion, 2 * radius, imageOriginal.size());
+
+        Mat denoised;
+        denoiseImage(imageOriginal(regionWithMargin), denoised, userSettings->denoise, radius, progress);
+        imageSource = denoised(Rect(denoisedRegion.x - regionWithMargin.x, denoisedRegion.y - regionWithMargin.y, denoisedRegion.width, denoisedRegion.height));
+        sourceRegion = Rect(region.x - denoisedRegion.x, region.y - denoisedRegion.y, region.width, region.height);
+    }
+
+    // Rozmycie jest wspólne dla obu transformacji (liczone z tego samego zdjęcia)
+    Mat clarityBlur;
+    if(clarityActive && (progress == NULL || !progress->cancelled))
+    {
+        int radius = clarityRadius(imageOriginal);
+        Rect regionWithMargin = expandRegion(sourceRegion, 3 * radius, imageSource.size());
+
+        createClarityBlur(imageSource(regionWithMargin), clarityBlur, radius, progress);
+        clarityBlur = clarityBlur(Rect(sourceRegion.x - regionWithMargin.x, sourceRegion.y - regionWithMargin.y, region.width, region.height));
+    }
+
+    // Render przerwany w trakcie odszumiania lub rozmycia kończy się bez transformowania (wyniki tych etapów są niepełne)
+    bool finished = false;
+    if(progress == NULL || !progress->cancelled)
+    {
+        image = imageSource(sourceRegion).clone();
+        finished = transformImage(image, userSettings, defaultSettings, lookUpTable, tonesLookUpTable, clarityBlur, scopes, progress, region.tl(), imageOriginal.size());
+    }
+
+    // Benchmarking
+    double duration = chrono::duration<double>(chrono::steady_clock::now() - start).count();
+    if(!finished)
+    {
+        cout << "Render przerwany po " << duration << "s" << endl;
+        return duration;
+    }
+    cout << "Render zdjęcia: "<< duration << "s (" << megapixelsPerSecond(image, duration) << " Mpx/s)" << endl;
+
+    return duration;
+}
+
+double updateImageWithSettings(Mat &image, Mat &imageOriginal, Settings *userSettings, const Settings *defaultSettings, int *lookUpTable, float *tonesLookUpTable, Scopes *scopes, RenderProgress *progress)
+{
+    return updateRegionWithSettings(image, imageOriginal, Rect(0, 0, imageOriginal.cols, imageOriginal.rows), userSettings, defaultSettings, lookUpTable, tonesLookUpTable, scopes, progress);
+}
+
+// Render w pełnej rozdzielczości w osobnym wątku, w tym czasie w terminalu wypisywany jest postęp w procentach
+double updateImageWithProgress(Mat &image, Mat &imageOriginal, Settings *userSettings, const Settings *defaultSettings, int *lookUpTable, float *tonesLookUpTable)
+{
+    RenderProgress progress;
+    atomic<bool> finished(false);
+    double duration = 0.0;
+
+    thread render([&]()
+    {
+        duration = updateImageWithSettings(image, imageOriginal, userSettings, defaultSettings, lookUpTable, tonesLookUpTable, NULL, &progress);
+        finished = true;
+    });
+
+    if(isatty(STDERR_FILENO))
+    {
+        int lastPercent = -1;
+        while(!finished)
+        {
+            this_thread::sleep_for(chrono::milliseconds(RENDER_PROGRESS_INTERVAL));
+            int percent = progress.rowsTotal > 0 ? progress.rowsDone * 100 / progress.rowsTotal : 0;
+            if(percent != lastPercent)
+            {
+                cerr << "\rPostęp renderu: " << percent << "%" << flush;
+                lastPercent = percent;
+            }
+        }
+        cerr << "\r";
+    }
+
+    render.join();
+    return duration;
+}
+
+// Eksport bez transformowania pikseli, które i tak zostałyby odrzucone przy pomniejszaniu
+// Jeśli żaden plik nie wymaga pełnej rozdzielczości, zdjęcie jest najpierw pomniejszane (INTER_AREA, z najbliższego większego
+// poziomu piramidy) do największego potrzebnego rozmiaru, a dopiero potem transformowane
+bool gradeAndExport(vector<Mat> &imagePyramid, vector<ExportOutput> outputs, Settings *userSettings, const Settings *defaultSettings, int *lookUpTable, float *tonesLookUpTable)
+{
+    int longerSide = max(imagePyramid[0].rows, imagePyramid[0].cols);
+    int largestSize = 0;
+
+    for(size_t i = 0; i < outputs.size(); i++)
+    {
+        largestSize = outputs[i].maxSize > 0 ? max(largestSize, min(outputs[i].maxSize, longerSide)) : longerSide;
+    }
+
+    Mat imageSource = imagePyramid[0];
+    for(size_t level = 1; level < imagePyramid.size() && max(imagePyramid[level].rows, imagePyramid[level].cols) >= largestSize; level++)
+    {
+        imageSource = imagePyramid[level];
+    }
+
+    if(max(imageSource.rows, imageSource.cols) > largestSize)
+    {
+        float scale = (float)largestSize / (float)max(imageSource.rows, imageSource.cols);
+        Mat imageSmaller;
+        resize(imageSource, imageSmaller, Size(max(1, (int)(imageSource.cols * scale + 0.5)), max(1, (int)(imageSource.rows * scale + 0.5))), 0, 0, INTER_AREA);
+        imageSource = imageSmaller;
+    }
+
+    Mat imageExport;
+    updateImageWithSettings(imageExport, imageSource, userSettings, defaultSettings, lookUpTable, tonesLookUpTable, NULL, NULL);
+
+    return exportOutputs(imageExport, outputs, &userSettings->exportProfile, userSettings->sharpen);
+}
+
+
+// ------------------------------------------------------------
+//  FUNKCJE KONTROLUJĄCE POPRAWNOŚĆ I WYDAJNOŚĆ TRANSFORMACJI
+// ------------------------------------------------------------
+
+// Porównanie wyniku z obrazem wzorcowym wygenerowanym wcześniejszą wersją programu (dopuszczalna różnica na kanał)
+bool compareWithReference(Mat image, string *referencePath, int tolerance)
+{
+    Mat reference = imread(*referencePath, IMREAD_COLOR);
+    if(reference.empty() || reference.rows != image.rows || reference.cols != image.cols)
+    {
+        cout << "Nie można porównać zdjęcia z wzorcem " << *referencePath << "!" << endl;
+        return false;
+    }
+
+    Mat difference;
+    double maxDifference;
+    absdiff(image, reference, difference);
+    minMaxLoc(difference.reshape(1, 0), NULL, &maxDifference);
+
+    if(maxDifference > tolerance)
+    {
+        cout << "Zdjęcie różni się od wzorca " << *referencePath << " (maksymalna różnica: " << maxDifference << ")!" << endl;
+        return false;
+    }
+    cout << "Zdjęcie zgodne ze wzorcem " << *referencePath << " (maksymalna różnica: " << maxDifference << ")" << endl;
+    return true;
+}
+
+// Wielokrotny render tego samego zdjęcia, brany jest najlepszy czas żeby ograniczyć wpływ innych procesów
+bool benchmarkSettings(Mat &image, Mat &imageOriginal, Settings *userSettings, const Settings *defaultSettings, int *lookUpTable, float *tonesLookUpTable)
+{
+    double bestDuration = 0.0;
+
+    for(int run = 0; run < userSettings->benchmarkRuns; run++)
+    {
+        double duration = updateImageWithSettings(image, imageOriginal, userSettings, defaultSettings, lookUpTable, tonesLookUpTable, NULL, NULL);
+        if(run == 0 || duration < bestDuration)
+        {
+            bestDuration = duration;
+        }
+    }
+
+    double megapixels = megapixelsPerSecond(image, bestDuration);
+    cout << "Najlepszy render: " << bestDuration << "s (" << megapixels << " Mpx/s)" << endl;
+
+    if(megapixels < userSettings->benchmarkMinMegapixels)
+    {
+        cout << "Wydajność poniżej progu " << userSettings->benchmarkMinMegapixels << " Mpx/s!" << endl;
+        return false;
+    }
+    return true;
+}
+
+// Czas kodowania i wielkość pliku dla każdego profilu i formatu (kodowanie w pamięci, bez zapisu na dysk)
+void benchmarkEncoding(Mat image)
+{
+    const char *profiles[] = {"", "fast", "web", "archive"};
+    const char *extensions[] = {"png", "jpg", "tif", "webp"};
+
+    cout << "Profil\tFormat\tCzas [s]\tRozmiar [KB]" << endl;
+    for(int format = 0; format < 4; format++)
+    {
+        for(int profile = 0; profile < 4; profile++)
+        {
+            string exportProfile = profiles[profile];
+            string path = string("benchmark.") + extensions[format];
+            vector<int> parameters;
+            vector<uchar> buffer;
+
+            exportParameters(&exportProfile, &path, parameters);
+
+            chrono::steady_clock::time_point start = chrono::steady_clock::now();
+            bool success = imencode(string(".") + extensions[format], image, buffer, parameters);
+            double duration = chrono::duration<double>(chrono::steady_clock::now() - start).count();
+
+            cout << (exportProfile.size() > 0 ? exportProfile : "domyślny") << "\t" << extensions[format] << "\t";
+            if(success)
+            {
+                cout << duration << "\t" << buffer.size() / 1024 << endl;
+            }
+            else
+            {
+                cout << "-\t-" << endl;
+            }
+        }
+    }
+}
+
+
+// ---------------------------------------------------
+//  FUNKCJE SPRAWDZAJĄCE ARGUMENTY WCZYTANE Z KONSOLI
+// ---------------------------------------------------
+
+bool checkArgumentInt(char **argv, int *argc, int i, string flag, int *userSetting, int valueMin, int valueMax)
+{
+    if((string)argv[i] == flag && (i + 1) < *argc){
+        int argVal = stoi(argv[i + 1]);
+        if( argVal < valueMax && argVal > valueMin)
+        {
+            *userSetting = argVal;
+        }
+        else
+        {
+            cout << "Błędna wartość!" << endl;
+            return true;
+        }
+    }
+    return false;
+}
+
+bool checkArgumentFloat(char **argv, int *argc, int i, string flag, float *userSetting, float valueMin, float valueMax)
+{
+    if((string)argv[i] == flag && (i + 1) < *argc){
+        float argVal = stof(argv[i + 1]);
+        if( argVal <= valueMax && argVal >= valueMin)
+        {
+            *userSetting = argVal;
+        }
+        else
+        {
+            cout << "Błędna wartość!" << endl;
+            return true;
+        }
+    }
+    return false;
+}
+
+void checkArgumentBool(char **argv, int i, string flag, bool *userSetting)
+{
+    if((string)argv[i] == flag){
+        *userSetting = true;
+    }
+}
+
+bool checkArgumentString(char **argv, int *argc, int i, string flag, string *userSetting)
+{
+    if((string)argv[i] == flag && (i + 1) < *argc){
+        string argVal = (string)argv[i + 1];
+        if(argVal.size() > 0)
+        {
+            *userSetting = argVal;
+        }
+        else
+        {
+            cout << "Błędna wartość!" << endl;
+            return true;
+        }
+    }
+    return false;
+}
+
+// Krzywa w postaci "x:y,x:y,..." (od 2 do CURVE_MAX_POINTS punktów, x rosnące, wartości 0-255), wypełniana od razu do tablicy
+bool checkArgumentCurve(char **argv, int *argc, int i, string flag, ToneCurve *curve, unsigned char *curveTable)
+{
+    if((string)argv[i] == flag && (i + 1) < *argc){
+        ToneCurve parsed;
+        const char *position = argv[i + 1];
+        int x, y, length;
+
+        while(sscanf(position, "%d:%d%n", &x, &y, &length) == 2)
+        {
+            if(parsed.count >= CURVE_MAX_POINTS || x < 0 || x > 255 || y < 0 || y > 255 || (parsed.count > 0 && x <= parsed.x[parsed.count - 1]))
+            {
+                break;
+            }
+            parsed.x[parsed.count] = x;
+            parsed.y[parsed.count] = y;
+            parsed.count++;
+
+            position += length;
+            if(*position != ',')
+            {
+                break;
+            }
+            position++;
+        }
+
+        if(parsed.count < 2 || *position != '\0')
+        {
+            cout << "Błędna wartość!" << endl;
+            return true;
+        }
+        *curve = parsed;
+        bakeToneCurve(curve, curveTable, 0, curve->count - 1);
+    }
+    return false;
+}
+
+// Wartości dla kolejnych zakresów barw oddzielone przecinkami, np. "0,0.2,0,0,0,-0.3,0,0"
+bool checkArgumentBands(char **argv, int *argc, int i, string flag, float *userSetting, float valueMin, float valueMax)
+{
+    if((string)argv[i] == flag && (i + 1) < *argc){
+        float parsed[HSL_BANDS];
+        const char *position = argv[i + 1];
+        int count = 0, length;
+
+        while(count < HSL_BANDS && sscanf(position, "%f%n", &parsed[count], &length) == 1 && parsed[count] >= valueMin && parsed[count] <= valueMax)
+        {
+            count++;
+            position += length;
+            if(*position != ',')
+            {
+                break;
+            }
+            position++;
+        }
+
+        if(count != HSL_BANDS || *position != '\0')
+        {
+            cout << "Błędna wartość!" << endl;
+            return true;
+        }
+        memcpy(userSetting, parsed, sizeof(parsed));
+    }
+    return false;
+}
+
+// Macierz mikseru wierszami w kolejności RGB, np. "1,0,0,0,1,0,0,0,1" (wartości -2.0 - 2.0)
+bool checkArgumentMatrix(char **argv, int *argc, int i, string flag, float userSetting[3][3])
+{
+    if((string)argv[i] == flag && (i + 1) < *argc){
+        const int channels[3] = {RED, GREEN, BLUE};
+        float parsed[3][3];
+        const char *position = argv[i + 1];
+        int count = 0, length;
+        float value;
+
+        while(count < 9 && sscanf(position, "%f%n", &value, &length) == 1 && value >= -2.0 && value <= 2.0)
+        {
+            parsed[channels[count / 3]][channels[count % 3]] = value;
+            count++;
+            position += length;
+            if(*position != ',')
+            {
+                break;
+            }
+            position++;
+        }
+
+        if(count != 9 || *position != '\0')
+        {
+            cout << "Błędna wartość!" << endl;
+            return true;
+        }
+        memcpy(userSetting, parsed, sizeof(parsed));
+    }
+    return false;
+}
+
+// Maska w postaci "linear:x0,y0,x1,y1" lub "radial:x,y,promieńX,promieńY,przejście" (współrzędne względne kadru)
+bool checkArgumentMask(char **argv, int *argc, int i, string flag, GradientMask *mask)
+{
+    if((string)argv[i] == flag && (i + 1) < *argc){
+        GradientMask parsed = *mask;
+        float *p = parsed.parameters;
+        bool valid = false;
+
+        if(sscanf(argv[i + 1], "linear:%f,%f,%f,%f", &p[0], &p[1], &p[2], &p[3]) == 4)
+        {
+            parsed.type = MASK_LINEAR;
+            valid = p[0] != p[2] || p[1] != p[3];
+        }
+        else if(sscanf(argv[i + 1], "radial:%f,%f,%f,%f,%f", &p[0], &p[1], &p[2], &p[3], &p[4]) == 5)
+        {
+            parsed.type = MASK_RADIAL;
+            valid = p[2] > 0.0 && p[3] > 0.0 && p[4] > 0.0 && p[4] <= 1.0;
+        }
+
+        if(!valid)
+        {
+            cout << "Błędna wartość!" << endl;
+            return true;
+        }
+        *mask = parsed;
+    }
+    return false;
+}
+
+// Odczyt flag od argumentu first, wspólny dla linii poleceń i presetów (true oznacza błędną wartość)
+bool readArguments(char **argv, int argc, int first, Settings *userSettings)
+{
+    for(int i = first; i < argc; i++)
+    {
+        if( checkArgumentInt(argv, &argc, i, "-b", &userSettings->brightness, -256, 256) ) return true;
+        if( checkArgumentInt(argv, &argc, i, "-c", &userSettings->contrast, -256, 256) ) return true;
+        if( checkArgumentInt(argv, &argc, i, "-t", &userSettings->colorTemperature, -256, 256) ) return true;
+        if( checkArgumentInt(argv, &argc, i, "-hr", &userSettings->hue[RED], -256, 256) ) return true;
+        if( checkArgumentInt(argv, &argc, i, "-hg", &userSettings->hue[GREEN], -256, 256) ) return true;
+        if( checkArgumentInt(argv, &argc, i, "-hb", &userSettings->hue[BLUE], -256, 256) ) return true;
+        if( checkArgumentFloat(argv, &argc, i, "-e", &userSettings->exposure, -4.0, 4.0) ) return true;
+        if( checkArgumentFloat(argv, &argc, i, "-s", &userSettings->saturation, 0.0, 4.0) ) return true;
+        if( checkArgumentInt(argv, &argc, i, "-l", &userSettings->lift, -256, 256) ) return true;
+        if( checkArgumentFloat(argv, &argc, i, "-g", &userSettings->gamma, 0.0, 4.0) ) return true;
+        if( checkArgumentFloat(argv, &argc, i, "-gn", &userSettings->gain, 0.0, 2.0) ) return true;
+        if( checkArgumentFloat(argv, &argc, i, "-sh", &userSettings->shadows, -1.0, 1.0) ) return true;
+        if( checkArgumentFloat(argv, &argc, i, "-md", &userSettings->midtones, -1.0, 1.0) ) return true;
+        if( checkArgumentFloat(argv, &argc, i, "-hl", &userSettings->highlights, -1.0, 1.0) ) return true;
+        if( checkArgumentFloat(argv, &argc, i, "-cl", &userSettings->clarity, -1.0, 1.0) ) return true;
+        if( checkArgumentFloat(argv, &argc, i, "-v", &userSettings->vignette, -1.0, 1.0) ) return true;
+        if( checkArgumentFloat(argv, &argc, i, "-dn", &userSettings->denoise, 0.0, 1.0) ) return true;
+        if( checkArgumentFloat(argv, &argc, i, "-sp", &userSettings->sharpen, 0.0, 2.0) ) return true;
+        if( checkArgumentBands(argv, &argc, i, "-hsls", userSettings->hslSaturation, -1.0, 1.0) ) return true;
+        if( checkArgumentBands(argv, &argc, i, "-hsll", userSettings->hslLuminance, -1.0, 1.0) ) return true;
+        if( checkArgumentInt(argv, &argc, i, "-k", &userSettings->whiteBalance, 1999, 12001) ) return true;
+        if( checkArgumentFloat(argv, &argc, i, "-tn", &userSettings->tint, -1.0, 1.0) ) return true;
+        if( checkArgumentMatrix(argv, &argc, i, "-mx", userSettings->channelMixer) ) return true;
+        if( checkArgumentCurve(argv, &argc, i, "-cv", &userSettings->curves[CURVE_MASTER], userSettings->curveTable[CURVE_MASTER]) ) return true;
+        if( checkArgumentCurve(argv, &argc, i, "-cvr", &userSettings->curves[RED], userSettings->curveTable[RED]) ) return true;
+        if( checkArgumentCurve(argv, &argc, i, "-cvg", &userSettings->curves[GREEN], userSettings->curveTable[GREEN]) ) return true;
+        if( checkArgumentCurve(argv, &argc, i, "-cvb", &userSettings->curves[BLUE], userSettings->curveTable[BLUE]) ) return true;
+        checkArgumentBool(argv, i, "--auto", &userSettings->autoAdjust);
+        if( checkArgumentString(argv, &argc, i, "-o", &userSettings->outputPath) ) return true;
+        if( checkArgumentString(argv, &argc, i, "-x", &userSettings->exportSpec) ) return true;
+        if( checkArgumentString(argv, &argc, i, "-p", &userSettings->exportProfile) ) return true;
+        checkArgumentBool(argv, i, "--encode-benchmark", &userSettings->encodeBenchmark);
+        checkArgumentBool(argv, i, "--pool-stats", &userSettings->poolStats);
+        checkArgumentBool(argv, i, "--linear", &userSettings->linearLight);
+        if( checkArgumentString(argv, &argc, i, "-ref", &userSettings->referencePath) ) return true;
+        if( checkArgumentInt(argv, &argc, i, "-tol", &userSettings->referenceTolerance, -1, 256) ) return true;
+        if( checkArgumentInt(argv, &argc, i, "-bench", &userSettings->benchmarkRuns, 0, 1001) ) return true;
+        if( checkArgumentFloat(argv, &argc, i, "-minmpx", &userSettings->benchmarkMinMegapixels, 0.0, 100000.0) ) return true;
+        if( checkArgumentString(argv, &argc, i, "--watch", &userSettings->watchDirectory) ) return true;
+        if( checkArgumentString(argv, &argc, i, "--preset", &userSettings->presetPath) ) return true;
+        if( checkArgumentString(argv, &argc, i, "--out", &userSettings->outputDirectory) ) return true;
+        if( checkArgumentString(argv, &argc, i, "--batch", &userSettings->batchManifest) ) return true;
+        if( checkArgumentMask(argv, &argc, i, "-mask", &userSettings->mask) ) return true;
+        checkArgumentBool(argv, i, "-mask-invert", &userSettings->mask.invert);
+        if( checkArgumentString(argv, &argc, i, "-mask-preset", &userSettings->maskPresetPath) ) return true;
+        if( checkArgumentString(argv, &argc, i, "--display-profile", &userSettings->displayProfile) ) return true;
+    }
+    return false;
+}
+
+
+// ---------------------------------
+//  FUNKCJE PRZETWARZANIA WSADOWEGO
+// ---------------------------------
+
+// Kolejka między etapami potoku, pop czeka na element i zwraca false dopiero po zamknięciu pustej kolejki
+template<typename T>
+class WorkQueue
+{
+public:
+    // Pojemność 0 oznacza kolejkę bez limitu, przy pełnej kolejce push czeka, aż następny etap zdejmie element
+    explicit WorkQueue(size_t capacity = 0) : capacity(capacity) {}
+
+    void push(T item)
+    {
+        {
+            unique_lock<mutex> guard(queueMutex);
+            spaceAvailable.wait(guard, [&]() { return capacity == 0 || items.size() < capacity; });
+            items.push_back(item);
+        }
+        queueChanged.notify_one();
+    }
+
+    bool pop(T &item)
+    {
+        unique_lock<mutex> guard(queueMutex);
+        queueChanged.wait(guard, [&]() { return items.size() > 0 || closed; });
+        if(items.empty())
+        {
+            return false;
+        }
+        item = items.front();
+        items.pop_front();
+        guard.unlock();
+        spaceAvailable.notify_one();
+        return true;
+    }
+
+    void close()
+    {
+        {
+            lock_guard<mutex> guard(queueMutex);
+            closed = true;
+        }
+        queueChanged.notify_all();
+    }
+
+private:
+    mutex queueMutex;
+    condition_variable queueChanged;
+    condition_variable spaceAvailable;
+    size_t capacity;
+    deque<T> items;
+    bool closed = false;
+};
+
+// Jedno zdjęcie przechodzące przez potok: dekodowanie, transformacja, zapis
+struct BatchJob
+{
+    string inputPath;
+    string outputPath;
+    Mat image;
+    bool success = false;
+    chrono::steady_clock::time_point start;
+    uint64_t inputHash = 0;
+    uint64_t presetHash = 0;
+    string claimPath;
+};
+
+// Potok działający przez cały czas pracy programu, każdy etap ma własny wątek, więc dekodowanie następnego zdjęcia
+// i zapis poprzedniego odbywają się w trakcie transformacji bieżącego (która sama korzysta ze wszystkich rdzeni)
+struct BatchPipeline
+{
+    Settings settings;
+    const Settings *defaultSettings;
+    WorkQueue<BatchJob *> decodeQueue;
+    WorkQueue<BatchJob *> gradeQueue{BATCH_QUEUE_CAPACITY};
+    WorkQueue<BatchJob *> encodeQueue{BATCH_QUEUE_CAPACITY};
+    vector<thread> threads;
+    function<void(BatchJob *)> finished;
+};
+
+void decodeStage(BatchPipeline *pipeline)
+{
+    BatchJob *job;
+    while(pipeline->decodeQueue.pop(job))
+    {
+        job->start = chrono::steady_clock::now();
+        job->image = imread(job->inputPath, IMREAD_COLOR);
+        pipeline->gradeQueue.push(job);
+    }
+    pipeline->gradeQueue.close();
+}
+
+// Tablice etapu transformacji są tworzone raz, zmieniają się tylko przy automatycznym doborze ustawień
+void gradeStage(BatchPipeline *pipeline)
+{
+    int lookUpTable[256][3];
+    float tonesLookUpTable[256];
+    BatchJob *job;
+
+    while(pipeline->gradeQueue.pop(job))
+    {
+        if(!job->image.empty())
+        {
+            Settings settings = pipeline->settings;
+            if(settings.autoAdjust)
+            {
+                autoAdjustSettings(job->image, &settings, pipeline->defaultSettings);
+            }
+
+            Mat image;
+            updateImageWithSettings(image, job->image, &settings, pipeline->defaultSettings, &lookUpTable[0][0], &tonesLookUpTable[0], NULL, NULL);
+            job->image = image;
+        }
+        pipeline->encodeQueue.push(job);
+    }
+    pipeline->encodeQueue.close();
+}
+
+void encodeStage(BatchPipeline *pipeline)
+{
+    BatchJob *job;
+    while(pipeline->encodeQueue.pop(job))
+    {
+        if(job->image.empty())
+        {
+            cout << "Nie można otworzyć pliku " << job->inputPath << "!" << endl;
+        }
+        else
+        {
+            job->success = saveFile(job->image, &job->outputPath, &pipeline->settings.exportProfile, pipeline->settings.sharpen);
+        }
+        job->image.release();
+
+        if(pipeline->finished)
+        {
+            pipeline->finished(job);
+        }
+        delete job;
+    }
+}
+
+void startBatchPipeline(BatchPipeline *pipeline)
+{
+    pipeline->threads.push_back(thread(decodeStage, pipeline));
+    pipeline->threads.push_back(thread(gradeStage, pipeline));
+    pipeline->threads.push_back(thread(encodeStage, pipeline));
+}
+
+// Zamknięcie wejścia potoku, wszystkie zdjęcia już w nim będące zostaną dokończone
+void stopBatchPipeline(BatchPipeline *pipeline)
+{
+    pipeline->decodeQueue.close();
+    for(size_t i = 0; i < pipeline->threads.size(); i++)
+    {
+        pipeline->threads[i].join();
+    }
+    pipeline->threads.clear();
+}
+
+bool isImageFile(string *path)
+{
+    string extension = fileExtension(path);
+    return extension == "png" || extension == "jpg" || extension == "jpeg" || extension == "tif" || extension == "tiff" || extension == "webp";
+}
+
+// Preset to plik z flagami takimi jak w linii poleceń (np. "-c 15 -s 1.2 --auto"), linie zaczynające się od # są pomijane
+bool readPresetFile(string *presetPath, Settings *settings)
+{
+    FILE *file = fopen(presetPath->c_str(), "r");
+    if(file == NULL)
+    {
+        cout << "Nie można otworzyć presetu " << *presetPath << "!" << endl;
+        return true;
+    }
+
+    vector<string> tokens;
+    char line[4096];
+    while(fgets(line, sizeof(line), file) != NULL)
+    {
+        if(line[0] == '#')
+        {
+            continue;
+        }
+        for(char *token = strtok(line, " \t\r\n"); token != NULL; token = strtok(NULL, " \t\r\n"))
+        {
+            tokens.push_back(token);
+        }
+    }
+    fclose(file);
+
+    vector<char *> arguments;
+    for(size_t i = 0; i < tokens.size(); i++)
+    {
+        arguments.push_back(&tokens[i][0]);
+    }
+    return readArguments(arguments.data(), arguments.size(), 0, settings);
+}
+
+// Tryb obserwowania katalogu: zdjęcia zapisane (IN_CLOSE_WRITE) lub przeniesione (IN_MOVED_TO) do katalogu trafiają od razu do potoku,
+// a wynik zapisywany jest pod tą samą nazwą w katalogu wyjściowym, program działa do przerwania
+int watchDirectory(Settings *userSettings, const Settings *defaultSettings)
+{
+    char watchPath[PATH_MAX], outputPath[PATH_MAX];
+    if(realpath(userSettings->watchDirectory.c_str(), watchPath) == NULL || realpath(userSettings->outputDirectory.c_str(), outputPath) == NULL)
+    {
+        cout << "Katalog " << userSettings->watchDirectory << " lub " << userSettings->outputDirectory << " nie istnieje!" << endl;
+        return 1;
+    }
+    // Zapis do obserwowanego katalogu wywołałby kolejne zdarzenie dla każdego wyniku
+    if(strcmp(watchPath, outputPath) == 0)
+    {
+        cout << "Katalog wyjściowy musi być inny niż obserwowany!" << endl;
+        return 1;
+    }
+
+    int inotifyFd = inotify_init1(IN_CLOEXEC);
+    if(inotifyFd < 0 || inotify_add_watch(inotifyFd, watchPath, IN_CLOSE_WRITE | IN_MOVED_TO) < 0)
+    {
+        cout << "Nie można obserwować katalogu " << watchPath << "!" << endl;
+        return 1;
+    }
+
+    BatchPipeline pipeline;
+    pipeline.settings = *userSettings;
+    pipeline.defaultSettings = defaultSettings;
+    pipeline.finished = [](BatchJob *job)
+    {
+        double duration = chrono::duration<double>(chrono::steady_clock::now() - job->start).count();
+        cout << (job->success ? "Gotowe: " : "Błąd: ") << job->inputPath << " (" << duration << "s)" << endl;
+    };
+    startBatchPipeline(&pipeline);
+
+    cout << "Obserwowanie katalogu " << watchPath << ", wyniki w " << outputPath << endl;
+
+    alignas(struct inotify_event) char buffer[WATCH_EVENT_BUFFER];
+    while(true)
+    {
+        ssize_t length = read(inotifyFd, buffer, sizeof(buffer));
+        if(length < 0 && errno == EINTR)
+        {
+            continue;
+        }
+        if(length <= 0)
+        {
+            break;
+        }
+
+        for(char *position = buffer; position < buffer + length; position += sizeof(struct inotify_event) + ((struct inotify_event *)position)->len)
+        {
+            struct inotify_event *event = (struct inotify_event *)position;
+            if(event->len == 0 || (event->mask & IN_ISDIR))
+            {
+                continue;
+            }
+
+            // Pliki ukryte to zwykle pliki tymczasowe programów kopiujących, gotowy plik pojawi się jako IN_MOVED_TO
+            string name = event->name;
+            if(name[0] == '.' || !isImageFile(&name))
+            {
+                continue;
+            }
+
+            BatchJob *job = new BatchJob();
+            job->inputPath = string(watchPath) + "/" + name;
+            job->outputPath = string(outputPath) + "/" + name;
+            pipeline.decodeQueue.push(job);
+        }
+    }
+
+    stopBatchPipeline(&pipeline);
+    close(inotifyFd);
+    return 0;
+}
+
+// Skrót zawartości pliku wejściowego (FNV-1a po zmapowanym pliku)
+bool hashFile(string *path, uint64_t *hash)
+{
+    int file = open(path->c_str(), O_RDONLY);
+    if(file < 0)
+    {
+        return false;
+    }
+
+    struct stat fileStat;
+    *hash = 14695981039346656037ULL;
+    if(fstat(file, &fileStat) == 0 && fileStat.st_size > 0)
+    {
+        void *data = mmap(NULL, fileStat.st_size, PROT_READ, MAP_PRIVATE, file, 0);
+        if(data == MAP_FAILED)
+        {
+            close(file);
+            return false;
+        }
+        madvise(data, fileStat.st_size, MADV_SEQUENTIAL);
+        *hash = hashBytes(*hash, data, fileStat.st_size);
+        munmap(data, fileStat.st_size);
+    }
+    close(file);
+    return true;
+}
+
+// Skrót presetu: ustawienia transformacji oraz wszystko, co jeszcze wpływa na plik wyjściowy
+uint64_t presetHash(Settings *settings)
+{
+    uint64_t hash = settingsHash(settings);
+    hash = hashBytes(hash, &settings->autoAdjust, sizeof(settings->autoAdjust));
+    hash = hashBytes(hash, settings->exportProfile.data(), settings->exportProfile.size());
+    hash = hashBytes(hash, &settings->sharpen, sizeof(settings->sharpen));
+    return hash;
+}
+
+string hashToString(uint64_t hash)
+{
+    char text[17];
+    snprintf(text, sizeof(text), "%016llx", (unsigned long long)hash);
+    return text;
+}
+
+// Dziennik zadania: każda linia to "stan, skrót wejścia, skrót presetu, wejście, wyjście" rozdzielone tabulatorami
+// Linie są dopisywane pojedynczym write z O_APPEND, więc kilka procesów może dopisywać do tego samego dziennika
+// Odczyt zaczyna się od *offset i przesuwa je za ostatnią pełną linię, więc kolejne odczyty wczytują tylko nowe wpisy
+void readJournal(string *journalPath, map<string, string> &completed, off_t *offset)
+{
+    FILE *file = fopen(journalPath->c_str(), "r");
+    if(file == NULL)
+    {
+        return;
+    }
+    if(fseeko(file, *offset, SEEK_SET) != 0)
+    {
+        fclose(file);
+        return;
+    }
+
+    char line[2 * PATH_MAX + 64];
+    while(fgets(line, sizeof(line), file) != NULL)
+    {
+        // Linia bez znaku końca jest właśnie dopisywana (np. przez NFS), zostanie wczytana przy następnym odczycie
+        size_t length = strlen(line);
+        if(length == 0 || line[length - 1] != '\n')
+        {
+            break;
+        }
+        *offset += length;
+
+        char *status = strtok(line, "\t\n");
+        char *inputHash = strtok(NULL, "\t\n");
+        char *presetHashText = strtok(NULL, "\t\n");
+        char *inputPath = strtok(NULL, "\t\n");
+        char *outputPath = strtok(NULL, "\t\n");
+        if(status != NULL && outputPath != NULL && strcmp(status, "done") == 0)
+        {
+            completed[string(inputPath) + "\t" + outputPath] = string(inputHash) + "\t" + presetHashText;
+        }
+    }
+    fclose(file);
+}
+
+void appendJournal(string *journalPath, string status, BatchJob *job)
+{
+    string line = status + "\t" + hashToString(job->inputHash) + "\t" + hashToString(job->presetHash) + "\t" + job->inputPath + "\t" + job->outputPath + "\n";
+
+    int file = open(journalPath->c_str(), O_WRONLY | O_CREAT | O_APPEND, 0644);
+    if(file >= 0)
+    {
+        if(write(file, line.data(), line.size()) != (ssize_t)line.size())
+        {
+            cout << "Nie udało się zapisać dziennika " << *journalPath << "!" << endl;
+        }
+        fsync(file);
+        close(file);
+    }
+}
+
+// Wynik jest aktualny, jeśli dziennik ma wpis "done" z tymi samymi skrótami, a plik wyjściowy nadal istnieje
+bool isUpToDate(map<string, string> &completed, BatchJob *job)
+{
+    map<string, string>::iterator entry = completed.find(job->inputPath + "\t" + job->outputPath);
+    return entry != completed.end() && entry->second == hashToString(job->inputHash) + "\t" + hashToString(job->presetHash) && access(job->outputPath.c_str(), F_OK) == 0;
+}
+
+// Zajęcie pozycji przez utworzenie dowiązania do własnego pliku, link() jest atomowe także na NFS, więc wygrywa dokładnie jeden proces
+// Zajęcie porzucone przez proces, który już nie działa (na tym samym komputerze) lub starsze niż BATCH_CLAIM_STALE_SECONDS jest przejmowane
+bool claimItem(string *claimPath, string *ownerPath, string *owner)
+{
+    // Zajęcia są dowiązaniami do pliku właściciela, więc odświeżenie jego czasu modyfikacji odświeża wszystkie zajęcia procesu
+    utime(ownerPath->c_str(), NULL);
+
+    for(int attempt = 0; attempt < 2; attempt++)
+    {
+        if(link(ownerPath->c_str(), claimPath->c_str()) == 0)
+        {
+            return true;
+        }
+        if(errno != EEXIST)
+        {
+            return false;
+        }
+
+        struct stat claimStat;
+        char holder[256] = "";
+        FILE *file = fopen(claimPath->c_str(), "r");
+        if(file == NULL || stat(claimPath->c_str(), &claimStat) != 0)
+        {
+            if(file != NULL)
+            {
+                fclose(file);
+            }
+            continue;
+        }
+        if(fgets(holder, sizeof(holder), file) == NULL)
+        {
+            holder[0] = '\0';
+        }
+        fclose(file);
+
+        char holderHost[256];
+        int holderPid = 0;
+        char ownerHost[256];
+        int ownerPid = 0;
+        bool stale = time(NULL) - claimStat.st_mtime > BATCH_CLAIM_STALE_SECONDS;
+        if(sscanf(holder, "%255s %d", holderHost, &holderPid) == 2 && sscanf(owner->c_str(), "%255s %d", ownerHost, &ownerPid) == 2)
+        {
+            stale = stale || (strcmp(holderHost, ownerHost) == 0 && holderPid != ownerPid && kill(holderPid, 0) != 0 && errno == ESRCH);
+        }
+        if(!stale)
+        {
+            return false;
+        }
+
+        // Przejęcie odbywa się pod blokadą pliku obok zajęcia: proces, który ją dostanie, sprawdza, czy zajęcie to wciąż
+        // ten sam plik (i-węzeł i czas modyfikacji), który uznał za porzucony, i dopiero wtedy go usuwa. Proces, który
+        // przyjdzie później, zobaczy już świeże zajęcie innego procesu albo wolne miejsce i spróbuje link() na nowo
+        string lockPath = *claimPath + ".lock";
+        int lockFile = open(lockPath.c_str(), O_RDWR | O_CREAT, 0644);
+        if(lockFile < 0)
+        {
+            return false;
+        }
+        if(flock(lockFile, LOCK_EX) == 0)
+        {
+            struct stat currentStat;
+            if(stat(claimPath->c_str(), &currentStat) == 0 && currentStat.st_ino == claimStat.st_ino && currentStat.st_dev == claimStat.st_dev &&
+               currentStat.st_mtime == claimStat.st_mtime)
+            {
+                unlink(claimPath->c_str());
+            }
+            flock(lockFile, LOCK_UN);
+        }
+        close(lockFile);
+    }
+    return false;
+}
+
+// Zadanie wsadowe według manifestu: każda linia to ścieżka zdjęcia i opcjonalnie (po tabulatorze) ścieżka wyniku
+// Można uruchomić kilka procesów na tym samym manifeście (także na różnych komputerach ze wspólnym katalogiem),
+// każdy zajmuje kolejne pozycje w katalogu MANIFEST.claims i dopisuje wyniki do dziennika MANIFEST.journal
+int runBatch(Settings *userSettings, const Settings *defaultSettings)
+{
+    FILE *manifest = fopen(userSettings->batchManifest.c_str(), "r");
+    if(manifest == NULL)
+    {
+        cout << "Nie można otworzyć manifestu " << userSettings->batchManifest << "!" << endl;
+        return 1;
+    }
+
+    vector<pair<string, string> > items;
+    char line[2 * PATH_MAX];
+    while(fgets(line, sizeof(line), manifest) != NULL)
+    {
+        char *inputPath = strtok(line, "\t\r\n");
+        char *outputPath = strtok(NULL, "\t\r\n");
+        if(inputPath == NULL || inputPath[0] == '#')
+        {
+            continue;
+        }
+
+        string input = inputPath;
+        string output;
+        if(outputPath != NULL)
+        {
+            output = outputPath;
+        }
+        else if(userSettings->outputDirectory.size() > 0)
+        {
+            size_t slash = input.rfind('/');
+            output = userSettings->outputDirectory + "/" + (slash == string::npos ? input : input.substr(slash + 1));
+        }
+        else
+        {
+            cout << "Brak ścieżki wyniku dla " << input << " (podaj ją w manifeście lub użyj --out)!" << endl;
+            fclose(manifest);
+            return 1;
+        }
+        items.push_back(make_pair(input, output));
+    }
+    fclose(manifest);
+
+    string journalPath = userSettings->batchManifest + ".journal";
+    string claimDirectory = userSettings->batchManifest + ".claims";
+    if(mkdir(claimDirectory.c_str(), 0755) != 0 && errno != EEXIST)
+    {
+        cout << "Nie można utworzyć katalogu " << claimDirectory << "!" << endl;
+        return 1;
+    }
+
+    // Plik właściciela, do którego tworzone są dowiązania zajmujące pozycje
+    char hostname[256] = "localhost";
+    gethostname(hostname, sizeof(hostname) - 1);
+    string owner = string(hostname) + " " + to_string((long long)getpid()) + "\n";
+    string ownerPath = claimDirectory + "/owner." + hostname + "." + to_string((long long)getpid());
+    FILE *ownerFile = fopen(ownerPath.c_str(), "w");
+    if(ownerFile == NULL)
+    {
+        cout << "Nie można utworzyć pliku " << ownerPath << "!" << endl;
+        return 1;
+    }
+    fputs(owner.c_str(), ownerFile);
+    fclose(ownerFile);
+
+    map<string, string> completed;
+    off_t journalOffset = 0;
+    readJournal(&journalPath, completed, &journalOffset);
+
+    uint64_t preset = presetHash(userSettings);
+    int skipped = 0, claimedElsewhere = 0;
+    atomic<int> succeeded(0), failed(0);
+
+    // Pozycje zajmowane są dopiero wtedy, gdy w potoku jest miejsce, żeby nie blokować ich innym procesom
+    mutex inFlightMutex;
+    condition_variable inFlightChanged;
+    int inFlight = 0;
+
+    BatchPipeline pipeline;
+    pipeline.settings = *userSettings;
+    pipeline.defaultSettings = defaultSettings;
+    pipeline.finished = [&](BatchJob *job)
+    {
+        appendJournal(&journalPath, job->success ? "done" : "failed", job);
+        unlink(job->claimPath.c_str());
+        (job->success ? succeeded : failed)++;
+        {
+            lock_guard<mutex> guard(inFlightMutex);
+            inFlight--;
+        }
+        inFlightChanged.notify_one();
+    };
+    startBatchPipeline(&pipeline);
+
+    for(size_t i = 0; i < items.size(); i++)
+    {
+        BatchJob *job = new BatchJob();
+        job->inputPath = items[i].first;
+        job->outputPath = items[i].second;
+        job->presetHash = preset;
+
+        if(!hashFile(&job->inputPath, &job->inputHash))
+        {
+            cout << "Nie można odczytać pliku " << job->inputPath << "!" << endl;
+            appendJournal(&journalPath, "failed", job);
+            failed++;
+            delete job;
+            continue;
+        }
+        if(isUpToDate(completed, job))
+        {
+            skipped++;
+            delete job;
+            continue;
+        }
+
+        {
+            unique_lock<mutex> guard(inFlightMutex);
+            inFlightChanged.wait(guard, [&]() { return inFlight < BATCH_MAX_IN_FLIGHT; });
+        }
+
+        job->claimPath = claimDirectory + "/" + hashToString(hashBytes(14695981039346656037ULL, job->outputPath.data(), job->outputPath.size()));
+        if(!claimItem(&job->claimPath, &ownerPath, &owner))
+        {
+            claimedElsewhere++;
+            delete job;
+            continue;
+        }
+
+        // Inny proces mógł skończyć tę pozycję między odczytem dziennika a zajęciem (wystarczy doczytać nowe linie)
+        readJournal(&journalPath, completed, &journalOffset);
+        if(isUpToDate(completed, job))
+        {
+            unlink(job->claimPath.c_str());
+            skipped++;
+            delete job;
+            continue;
+        }
+
+        {
+            lock_guard<mutex> guard(inFlightMutex);
+            inFlight++;
+        }
+        pipeline.decodeQueue.push(job);
+    }
+
+    stopBatchPipeline(&pipeline);
+    unlink(ownerPath.c_str());
+
+    cout << "Zadanie zakończone: " << succeeded << " gotowych, " << skipped << " aktualnych, " << claimedElsewhere << " zajętych przez inne procesy, " << failed << " błędów" << endl;
+    return failed > 0 ? 1 : 0;
+}
+
+
+
+// --------------------------------------
+//  FUNKCJE ZARZĄDZANIA KOLOREM MONITORA
+// --------------------------------------
+
+void createDisplayLutGrid(DisplayLut *displayLut)
+{
+    for(int value = 0; value < 256; value++)
+    {
+        int position = value * (displayLut->size - 1) * 256 / 255;
+        displayLut->gridIndex[value] = min(position >> 8, displayLut->size - 2);
+        displayLut->gridWeight[value] = position - displayLut->gridIndex[value] * 256;
+    }
+}
+
+// Plik .cube (np. z programu do kalibracji monitora): LUT_3D_SIZE, opcjonalnie DOMAIN_MIN i DOMAIN_MAX, potem size^3 linii "r g b"
+// DOMAIN_MIN i DOMAIN_MAX opisują zakres wejściowy siatki, obsługiwany jest tylko domyślny 0-1, a wartości wyjściowe są zawsze 0-1
+bool readCubeFile(string *path, DisplayLut *displayLut)
+{
+    FILE *file = fopen(path->c_str(), "r");
+    if(file == NULL)
+    {
+        return false;
+    }
+
+    char line[256];
+    float domainMin[3] = {0.0, 0.0, 0.0}, domainMax[3] = {1.0, 1.0, 1.0};
+    int size = 0, entries = 0;
+    vector<uchar> table;
+
+    while(fgets(line, sizeof(line), file) != NULL)
+    {
+        float red, green, blue;
+
+        if(line[0] == '#' || line[0] == '\n' || line[0] == '\r' || strncmp(line, "TITLE", 5) == 0)
+            continue;
+        if(sscanf(line, "LUT_3D_SIZE %d", &size) == 1)
+        {
+            if(size < 2 || size > 256)
+                break;
+            table.resize((size_t)size * size * size * 3);
+            continue;
+        }
+        if(sscanf(line, "DOMAIN_MIN %f %f %f", &domainMin[0], &domainMin[1], &domainMin[2]) == 3 ||
+           sscanf(line, "DOMAIN_MAX %f %f %f", &domainMax[0], &domainMax[1], &domainMax[2]) == 3)
+        {
+            if(domainMin[0] != 0.0f || domainMin[1] != 0.0f || domainMin[2] != 0.0f || domainMax[0] != 1.0f || domainMax[1] != 1.0f || domainMax[2] != 1.0f)
+            {
+                cout << "Tablica " << *path << " ma zakres wejściowy (DOMAIN_MIN, DOMAIN_MAX) inny niż 0-1!" << endl;
+                entries = -1;
+                break;
+            }
+            continue;
+        }
+        if(sscanf(line, "%f %f %f", &red, &green, &blue) != 3 || size == 0 || entries >= size * size * size)
+        {
+            entries = -1;
+            break;
+        }
+
+        float color[3] = {red, green, blue};
+        for(int i = 0; i <= 2; i++)
+        {
+            table[entries * 3 + i] = saturate_cast<uchar>(255.0f * color[i]);
+        }
+        entries++;
+    }
+    fclose(file);
+
+    if(size == 0 || entries != size * size * size)
+    {
+        return false;
+    }
+    displayLut->size = size;
+    displayLut->table = table;
+    createDisplayLutGrid(displayLut);
+    return true;
+}
+
+#ifdef USE_LCMS2
+// Profil ICC monitora: przekształcenie z sRGB liczone przez lcms2 raz dla wszystkich węzłów tablicy
+bool readIccProfile(string *path, DisplayLut *displayLut)
+{
+    cmsHPROFILE displayProfile = cmsOpenProfileFromFile(path->c_str(), "r");
+    if(displayProfile == NULL)
+    {
+        return false;
+    }
+    cmsHPROFILE sourceProfile = cmsCreate_sRGBProfile();
+    cmsHTRANSFORM transform = cmsCreateTransform(sourceProfile, TYPE_RGB_8, displayProfile, TYPE_RGB_8, INTENT_PERCEPTUAL, 0);
+    cmsCloseProfile(sourceProfile);
+    cmsCloseProfile(displayProfile);
+    if(transform == NULL)
+    {
+        return false;
+    }
+
+    int size = DISPLAY_LUT_SIZE;
+    vector<uchar> grid((size_t)size * size * size * 3);
+    for(int blue = 0; blue < size; blue++)
+    {
+        for(int green = 0; green < size; green++)
+        {
+            for(int red = 0; red < size; red++)
+            {
+                uchar *node = &grid[(((size_t)blue * size + green) * size + red) * 3];
+                node[0] = (red * 255 + (size - 1) / 2) / (size - 1);
+                node[1] = (green * 255 + (size - 1) / 2) / (size - 1);
+                node[2] = (blue * 255 + (size - 1) / 2) / (size - 1);
+            }
+        }
+    }
+
+    displayLut->size = size;
+    displayLut->table.resize(grid.size());
+    cmsDoTransform(transform, &grid[0], &displayLut->table[0], size * size * size);
+    cmsDeleteTransform(transform);
+    createDisplayLutGrid(displayLut);
+    return true;
+}
+#endif
+
+bool loadDisplayLut(string *path, shared_ptr<DisplayLut> &displayLut)
+{
+    shared_ptr<DisplayLut> loaded = make_shared<DisplayLut>();
+    string extension = fileExtension(path);
+
+    if(extension == "cube")
+    {
+        if(!readCubeFile(path, loaded.get()))
+        {
+            cout << "Nie można wczytać tablicy " << *path << "!" << endl;
+            return false;
+        }
+    }
+    else
+    {
+#ifdef USE_LCMS2
+        if(!readIccProfile(path, loaded.get()))
+        {
+            cout << "Nie można wczytać profilu ICC " << *path << "!" << endl;
+            return false;
+        }
+#else
+        cout << "Profile ICC wymagają kompilacji z lcms2 (-DUSE_LCMS2), można użyć pliku .cube!" << endl;
+        return false;
+#endif
+    }
+    displayLut = loaded;
+    return true;
+}
+
+// Zamiana BGR na RGB połączona z przekształceniem przez tablicę 3D (interpolacja trójliniowa na liczbach całkowitych),
+// wynik zapisywany jest od razu w pamięci Pixbuf, więc zarządzanie kolorem nie dodaje osobnego przejścia przez zdjęcie
+void convertWithDisplayLut(Mat source, Mat destination, DisplayLut *displayLut)
+{
+    const uchar *table = &displayLut->table[0];
+    int strideGreen = displayLut->size * 3, strideBlue = displayLut->size * displayLut->size * 3;
+
+    int bands = (source.rows + RENDER_BAND_ROWS - 1) / RENDER_BAND_ROWS;
+    parallel_for_(Range(0, bands), [&](const Range &range)
+    {
+        for(int y = range.start * RENDER_BAND_ROWS; y < min(range.end * RENDER_BAND_ROWS, source.rows); y++)
+        {
+            const Vec3b *sourceRow = source.ptr<Vec3b>(y);
+            uchar *destinationRow = destination.ptr<uchar>(y);
+
+            for(int x = 0; x < source.cols; x++)
+            {
+                Vec3b color = sourceRow[x];
+                int weightRed = displayLut->gridWeight[color[RED]], weightGreen = displayLut->gridWeight[color[GREEN]], weightBlue = displayLut->gridWeight[color[BLUE]];
+                const uchar *node = table + displayLut->gridIndex[color[BLUE]] * strideBlue + displayLut->gridIndex[color[GREEN]] * strideGreen + displayLut->gridIndex[color[RED]] * 3;
+
+                for(int i = 0; i <= 2; i++)
+                {
+                    const uchar *corner = node + i;
+                    int c00 = corner[0] * 256 + (corner[3] - corner[0]) * weightRed;
+                    int c10 = corner[strideGreen] * 256 + (corner[strideGreen + 3] - corner[strideGreen]) * weightRed;
+                    int c01 = corner[strideBlue] * 256 + (corner[strideBlue + 3] - corner[strideBlue]) * weightRed;
+                    int c11 = corner[strideBlue + strideGreen] * 256 + (corner[strideBlue + strideGreen + 3] - corner[strideBlue + strideGreen]) * weightRed;
+                    int c0 = (c00 * 256 + (c10 - c00) * weightGreen) >> 8;
+                    int c1 = (c01 * 256 + (c11 - c01) * weightGreen) >> 8;
+                    destinationRow[x * 3 + i] = (c0 * 256 + (c1 - c0) * weightBlue + 32768) >> 16;
+                }
+            }
+        }
+    });
+}
+
+
+
+// ---------------------------------------------------
+//  FUNKCJE KONWERTUJĄCE ZDJĘCIE Z TYPU Mat DO Pixbuf
+// ---------------------------------------------------
+
+void calculateImageSize(AppData *appData, int *width, int *height)
+{
+    float widthFloat, heightFloat;
+
+    if(appData->image.cols > appData->image.rows)
+    {
+        heightFloat = (float)appData->image.rows * ((float)appData->imageSizeWidth / (float)appData->image.cols);
+        if(heightFloat > (float)appData->imageSizeHeight)
+        {
+            heightFloat = (float)appData->imageSizeHeight;
+        }
+        widthFloat = (float)appData->image.cols * (heightFloat / (float)appData->image.rows);
+    }
+    else
+    {
+        widthFloat = (float)appData->image.cols * ((float)appData->imageSizeHeight / (float)appData->image.rows);
+        if(widthFloat > (float)appData->imageSizeWidth)
+        {
+            widthFloat = (float)appData->imageSizeWidth;
+        }
+        heightFloat = (float)appData->image.rows * (widthFloat / (float)appData->image.cols);
+    }
+
+    *width = (int)widthFloat - (2 * IMAGE_CONTAINER_MARGIN);
+    *height = (int)heightFloat - (2 * IMAGE_CONTAINER_MARGIN);
+}
+
+// Powiększenie, przy którym całe zdjęcie mieści się w imageContainer
+float calculateFitZoom(AppData *appData)
+{
+    int width, height;
+    calculateImageSize(appData, &width, &height);
+    return (float)width / (float)appData->imageOriginal.cols;
+}
+
+// W trybie powiększenia renderowany jest tylko widoczny wycinek z najmniejszego poziomu piramidy, który ma wystarczającą rozdzielczość
+// Uruchomienie wątku roboczego, wątki korzystają z AppData (na stosie funkcji main), więc nie mogą być odłączone
+// Przy okazji dołączane są wątki, które już zakończyły pracę
+void startWorker(AppData *appData, function<void()> work)
+{
+    for(list<WorkerThread>::iterator worker = appData->workers.begin(); worker != appData->workers.end();)
+    {
+        if(*worker->finished)
+        {
+            worker->handle.join();
+            worker = appData->workers.erase(worker);
+        }
+        else
+        {
+            worker++;
+        }
+    }
+
+    shared_ptr<atomic<bool>> finished = make_shared<atomic<bool>>(false);
+    appData->workers.push_back(WorkerThread());
+    appData->workers.back().finished = finished;
+    appData->workers.back().handle = thread([work, finished]()
+    {
+        work();
+        *finished = true;
+    });
+}
+
+// Przerwanie renderu powiększonego wycinka, jego wynik jest odrzucany
+void cancelZoomRendering(AppData *appData)
+{
+    if(appData->zoomProgress)
+    {
+        appData->zoomProgress->cancelled = true;
+        appData->zoomProgress.reset();
+    }
+}
+
+void displayImage(AppData *appData);
+
+// Podmiana wycinka po zakończeniu renderu, wykonywana w wątku interfejsu (tylko jeśli w międzyczasie render nie został przerwany)
+gboolean finishZoomRendering(gpointer data)
+{
+    ZoomRenderJob *job = (ZoomRenderJob *)data;
+    AppData *appData = job->appData;
+
+    if(!job->progress->cancelled && appData->zoomProgress == job->progress)
+    {
+        appData->zoomProgress.reset();
+        appData->zoomImage = job->image;
+        appData->zoomLevel = job->level;
+        appData->zoomRegion = job->region;
+        appData->zoomHash = job->hash;
+        displayImage(appData);
+    }
+
+    delete job;
+    return FALSE;
+}
+
+void zoomRenderWorker(ZoomRenderJob *job)
+{
+    updateRegionWithSettings(job->image, job->levelImage, job->region, &job->settings, job->appData->defaultSettings, &job->lookUpTable[0][0], &job->tonesLookUpTable[0], NULL, job->progress.get());
+    g_idle_add(finishZoomRendering, job);
+}
+
+// Render wycinka w tle z ustawieniami wyświetlanego podglądu, ten sam wycinek nie jest renderowany ponownie,
+// a render nieaktualnego wycinka (np. podczas przesuwania) jest przerywany
+void startZoomRendering(AppData *appData, int level, Rect region, uint64_t hash)
+{
+    if(appData->zoomProgress && appData->zoomPendingLevel == level && appData->zoomPendingRegion == region && appData->zoomPendingHash == hash)
+    {
+        return;
+    }
+    cancelZoomRendering(appData);
+
+    ZoomRenderJob *job = new ZoomRenderJob();
+    job->appData = appData;
+    job->progress = make_shared<RenderProgress>();
+    job->hash = hash;
+    job->level = level;
+    job->region = region;
+    job->settings = appData->displayedSettings;
+    job->levelImage = appData->imagePyramid[level];
+
+    appData->zoomProgress = job->progress;
+    appData->zoomPendingLevel = level;
+    appData->zoomPendingRegion = region;
+    appData->zoomPendingHash = hash;
+    startWorker(appData, [job]() { zoomRenderWorker(job); });
+}
+
+void renderZoomedRegion(AppData *appData, Mat &imageTemp)
+{
+    int width = appData->imageSizeWidth - (2 * IMAGE_CONTAINER_MARGIN);
+    int height = appData->imageSizeHeight - (2 * IMAGE_CONTAINER_MARGIN);
+
+    int level = 0;
+    while(level + 1 < (int)appData->imagePyramid.size() && appData->zoom * (1 << (level + 1)) <= 1.0)
+    {
+        level++;
+    }
+
+    Mat levelImage = appData->imagePyramid[level];
+    float levelZoom = appData->zoom * (float)appData->imageOriginal.cols / (float)levelImage.cols;
+
+    int regionWidth = max(1, min(levelImage.cols, (int)ceil(width / levelZoom)));
+    int regionHeight = max(1, min(levelImage.rows, (int)ceil(height / levelZoom)));
+    int regionX = min(max(0, (int)(appData->panX * levelImage.cols) - regionWidth / 2), levelImage.cols - regionWidth);
+    int regionY = min(max(0, (int)(appData->panY * levelImage.rows) - regionHeight / 2), levelImage.rows - regionHeight);
+    Rect region(regionX, regionY, regionWidth, regionHeight);
+
+    // Wycinek renderowany jest w tle, do tego czasu wyświetlany jest odpowiadający mu fragment podglądu (w niższej rozdzielczości)
+    Mat regionImage;
+    int interpolation = levelZoom < 1.0 ? INTER_AREA : INTER_NEAREST;
+    uint64_t hash = settingsHash(&appData->displayedSettings);
+    if(appData->displayOriginalPhoto)
+    {
+        regionImage = levelImage(region);
+    }
+    else if(!appData->zoomImage.empty() && appData->zoomLevel == level && appData->zoomRegion == region && appData->zoomHash == hash)
+    {
+        regionImage = appData->zoomImage;
+    }
+    else
+    {
+        float scaleX = (float)appData->image.cols / levelImage.cols, scaleY = (float)appData->image.rows / levelImage.rows;
+        Rect previewRegion(region.x * scaleX, region.y * scaleY, max(1, (int)(region.width * scaleX)), max(1, (int)(region.height * scaleY)));
+        regionImage = appData->image(previewRegion & Rect(0, 0, appData->image.cols, appData->image.rows));
+        interpolation = INTER_LINEAR;
+        startZoomRendering(appData, level, region, hash);
+    }
+
+    Size displaySize(max(1, min(width, (int)(regionWidth * levelZoom))), max(1, min(height, (int)(regionHeight * levelZoom))));
+    resize(regionImage, imageTemp, displaySize, 0, 0, interpolation);
+}
+
+// Zwolnienie pikseli Pixbuf oznacza oddanie ich do puli buforów
+void releasePixbufPixels(guchar *pixels, gpointer data)
+{
+    bufferPool()->give(pixels, (size_t)GPOINTER_TO_SIZE(data));
+}
+
+GdkPixbuf * convertMatPixbuf(AppData *appData, GdkPixbuf *pixbuf)
+{
+    Mat imageTemp;
+    int width, height;
+
+    calculateImageSize(appData, &width, &height);
+
+    // W trybie powiększenia wyświetlany jest tylko widoczny wycinek
+    if(appData->zoom > 0.0)
+    {
+        renderZoomedRegion(appData, imageTemp);
+    }
+    // Jeśli jest wciśnięty przycisk "Podejrzyj oryginał" załaduj oryginalne zdjęcie
+    else if(appData->displayOriginalPhoto)
+    {        
+        resize(appData->imagePreview, imageTemp, Size(width, height), 0, 0, INTER_AREA);
+    }
+    else
+    {
+        resize(appData->image, imageTemp, Size(width, height), 0, 0, INTER_AREA);
+    }
+
+    // Piksele Pixbuf pochodzą z puli, kolejne klatki o tym samym rozmiarze używają tego samego bufora
+    int rowstride = (imageTemp.cols * 3 + 3) & ~3;
+    size_t size = (size_t)rowstride * imageTemp.rows;
+    guchar *pixels = (guchar *)bufferPool()->take(size);
+    if(!pixels)
+    {
+        return gdk_pixbuf_new(GDK_COLORSPACE_RGB, false, 8, imageTemp.cols, imageTemp.rows);
+    }
+    pixbuf = gdk_pixbuf_new_from_data(pixels, GDK_COLORSPACE_RGB, false, 8, imageTemp.cols, imageTemp.rows, rowstride, releasePixbufPixels, GSIZE_TO_POINTER(size));
+
+    // Zamiana kolejności kanałów BGR na RGB (z profilem monitora razem z przekształceniem kolorów) bezpośrednio w pamięci Pixbuf
+    Mat pixbufImage(imageTemp.rows, imageTemp.cols, CV_8UC3, pixels, rowstride);
+    if(appData->displayLut)
+    {
+        convertWithDisplayLut(imageTemp, pixbufImage, appData->displayLut.get());
+    }
+    else
+    {
+        cvtColor(imageTemp, pixbufImage, COLOR_BGR2RGB);
+    }
+
+    return pixbuf;
+}
+
+
+// ----------------------------------------------------
+//  FUNKCJE HISTORII USTAWIEŃ I ZAPAMIĘTANYCH RENDERÓW
+// ----------------------------------------------------
+
+// Wyszukanie renderu podglądu w pamięci, znaleziony wpis przesuwany jest na początek listy (najświeższy)
+bool findCachedRender(AppData *appData, uint64_t hash)
+{
+    for(list<RenderCacheEntry>::iterator entry = appData->renderCache.begin(); entry != appData->renderCache.end(); entry++)
+    {
+        if(entry->hash == hash)
+        {
+            appData->renderCache.splice(appData->renderCache.begin(), appData->renderCache, entry);
+            appData->image = entry->image.clone();
+            appData->scopes = entry->scopes;
+            return true;
+        }
+    }
+    return false;
+}
+
+// Zapamiętanie aktualnego renderu, najdawniej używane wpisy usuwane są po przekroczeniu RENDER_CACHE_MAX_BYTES
+void storeCachedRender(AppData *appData, uint64_t hash)
+{
+    RenderCacheEntry entry;
+    entry.hash = hash;
+    entry.image = appData->image.clone();
+    entry.scopes = appData->scopes;
+
+    appData->renderCache.push_front(entry);
+    appData->renderCacheBytes += entry.image.total() * entry.image.elemSize() + sizeof(Scopes);
+
+    while(appData->renderCache.size() > 1 && appData->renderCacheBytes > RENDER_CACHE_MAX_BYTES)
+    {
+        RenderCacheEntry &oldest = appData->renderCache.back();
+        appData->renderCacheBytes -= oldest.image.total() * oldest.image.elemSize() + sizeof(Scopes);
+        appData->renderCache.pop_back();
+    }
+}
+
+void clearCachedRenders(AppData *appData)
+{
+    appData->renderCache.clear();
+    appData->renderCacheBytes = 0;
+}
+
+// Poprzednio zastosowane ustawienia trafiają do historii tylko wtedy, gdy nowe się od nich różnią
+void recordHistory(AppData *appData)
+{
+    if(appData->appliedSettingsValid && presetHash(appData->userSettings) != presetHash(&appData->appliedSettings))
+    {
+        appData->undoHistory.push_back(appData->appliedSettings);
+        if(appData->undoHistory.size() > HISTORY_MAX_STEPS)
+        {
+            appData->undoHistory.erase(appData->undoHistory.begin());
+        }
+        appData->redoHistory.clear();
+    }
+    appData->appliedSettings = *appData->userSettings;
+    appData->appliedSettingsValid = true;
+}
+
+
+// ------------------------------------------
+//  FUNKCJE OBSŁUGUJĄCE INTERFEJST GRAFICZNY
+// ------------------------------------------
+
+void saveButtonValueInt(GtkWidget *widget, gpointer data)
+{
+    double buttonValue = gtk_spin_button_get_value((GtkSpinButton *)widget);
+    *(int *)data = (int)buttonValue;
+}
+
+void saveButtonValueFloat(GtkWidget *widget, gpointer data)
+{
+    double buttonValue = gtk_spin_button_get_value((GtkSpinButton *)widget);
+    *(float *)data = (float)buttonValue;
+}
+
+void saveButtonValueBool(GtkWidget *widget, gpointer data)
+{
+    *(bool *)data = gtk_toggle_button_get_active((GtkToggleButton *)widget);
+}
+
+void showOnButtonInt(GObject *button, gpointer value)
+{
+    int *valueInt = (int *)value;
+    double valueDouble = (double)*valueInt;
+    gtk_spin_button_set_value((GtkSpinButton *)button, valueDouble);
+}
+
+void showOnButtonFloat(GObject *button, gpointer value)
+{
+    float *valueFloat = (float *)value;
+    double valueDouble = (double)*valueFloat;
+    gtk_spin_button_set_value((GtkSpinButton *)button, valueDouble);
+}
+
+void showOnButtonBool(GObject *button, gpointer value)
+{
+    gtk_toggle_button_set_active((GtkToggleButton *)button, *(bool *)value);
+}
+
+void refreshButtonLabels(AppData *appData)
+{ 
+    gtk_file_chooser_set_filename((GtkFileChooser *)*appData->chooseFileButton, (*appData->imageName).c_str());
+    showOnButtonInt(*appData->brightnessButton, &appData->userSettings->brightness);
+    showOnButtonInt(*appData->contrastButton, &appData->userSettings->contrast);
+    showOnButtonFloat(*appData->exposureButton, &appData->userSettings->exposure);
+    showOnButtonFloat(*appData->saturationButton, &appData->userSettings->saturation);
+    showOnButtonInt(*appData->temperatureButton, &appData->userSettings->colorTemperature);
+    showOnButtonInt(*appData->hueRedButton, &appData->userSettings->hue[RED]);
+    showOnButtonInt(*appData->hueGreenButton, &appData->userSettings->hue[GREEN]);
+    showOnButtonInt(*appData->hueBlueButton, &appData->userSettings->hue[BLUE]);
+    showOnButtonInt(*appData->liftButton, &appData->userSettings->lift);
+    showOnButtonFloat(*appData->gammaButton, &appData->userSettings->gamma);
+    showOnButtonFloat(*appData->gainButton, &appData->userSettings->gain);
+    showOnButtonFloat(*appData->shadowsButton, &appData->userSettings->shadows);
+    showOnButtonFloat(*appData->midtonesButton, &appData->userSettings->midtones);
+    showOnButtonFloat(*appData->highlightsButton, &appData->userSettings->highlights);
+    showOnButtonFloat(*appData->clarityButton, &appData->userSettings->clarity);
+    showOnButtonFloat(*appData->vignetteButton, &appData->userSettings->vignette);
+    showOnButtonFloat(*appData->denoiseButton, &appData->userSettings->denoise);
+    showOnButtonFloat(*appData->sharpenButton, &appData->userSettings->sharpen);
+    showOnButtonInt(*appData->whiteBalanceButton, &appData->userSettings->whiteBalance);
+    showOnButtonFloat(*appData->tintButton, &appData->userSettings->tint);
+    showOnButtonBool(*appData->linearLightButton, &appData->userSettings->linearLight);
+    showOnButtonFloat(*appData->hslSaturationButton, &appData->userSettings->hslSaturation[appData->hslBand]);
+    showOnButtonFloat(*appData->hslLuminanceButton, &appData->userSettings->hslLuminance[appData->hslBand]);
+    gtk_widget_queue_draw(*appData->curveArea);
+}
+
+void displayImage(AppData *appData)
+{
+    // Jeśli zdjęcie zostało wczytane to można je wyświetlić
+    if(appData->imageName->size() > 0 && !appData->image.empty())
+    {
+        GdkPixbuf *pixbuf;
+
+        // Konwersja Mat na Pixbuf
+        pixbuf = convertMatPixbuf(appData, pixbuf);
+
+        // Wyświetlenie Pixbuf
+        gtk_image_set_from_pixbuf((GtkImage *)*appData->imageContainer, pixbuf);
+
+        // Zwalnianie pamięci
+        g_object_unref(pixbuf);
+    }
+
+}
+
+void getImageContainerSize(GtkWidget *widget, GtkAllocation *allocation, void *data)
+{
+    AppData *appData = (AppData *)data;
+
+    if(allocation->width != appData->imageSizeWidth || allocation->height != appData->imageSizeHeight)
+    {
+        appData->imageSizeWidth = allocation->width;
+        appData->imageSizeHeight = allocation->height;
+        
+        if(appData->imageName->size() > 0)
+        {
+            displayImage(appData);
+        }
+    }
+}
+
+// Przerwanie renderu podglądu, wątek kończy bieżące pasma, a jego wynik jest odrzucany
+void cancelRendering(AppData *appData)
+{
+    if(appData->renderProgress)
+    {
+        appData->renderProgress->cancelled = true;
+        appData->renderProgress.reset();
+    }
+}
+
+// Przerwanie wczytywania i renderu oraz oczekiwanie na wszystkie wątki robocze przed zniszczeniem AppData
+// Wyniki przekazane przez g_idle_add po zakończeniu pętli interfejsu nie są już wykonywane
+void joinWorkers(AppData *appData)
+{
+    appData->loadGeneration++;
+    cancelRendering(appData);
+    cancelZoomRendering(appData);
+
+    for(WorkerThread &worker : appData->workers)
+    {
+        worker.handle.join();
+    }
+    appData->workers.clear();
+}
+
+// Pasek postępu pojawia się dopiero jeśli render trwa dłużej niż RENDER_PROGRESS_INTERVAL, podczas wczytywania należy do wczytywania
+gboolean updateRenderProgress(gpointer data)
+{
+    AppData *appData = (AppData *)data;
+
+    if(appData->loading)
+    {
+        return TRUE;
+    }
+    if(!appData->renderProgress)
+    {
+        appData->renderProgressShown = false;
+        gtk_widget_hide(*appData->loadingProgress);
+        return FALSE;
+    }
+
+    int rowsTotal = appData->renderProgress->rowsTotal;
+    gtk_progress_bar_set_fraction(GTK_PROGRESS_BAR(*appData->loadingProgress), rowsTotal > 0 ? (double)appData->renderProgress->rowsDone / rowsTotal : 0.0);
+    gtk_widget_show(*appData->loadingProgress);
+    return TRUE;
+}
+
+// Podmiana podglądu po zakończeniu renderu, wykonywana w wątku interfejsu (tylko jeśli w międzyczasie render nie został przerwany)
+gboolean finishRendering(gpointer data)
+{
+    RenderJob *job = (RenderJob *)data;
+    AppData *appData = job->appData;
+
+    if(!job->progress->cancelled && appData->renderProgress == job->progress)
+    {
+        appData->renderProgress.reset();
+        appData->image = job->image;
+        appData->displayedSettings = job->settings;
+        appData->scopes = job->scopes;
+        appData->scopesReady = true;
+        storeCachedRender(appData, job->hash);
+
+        displayImage(appData);
+        gtk_widget_queue_draw(*appData->scopesArea);
+    }
+
+    delete job;
+    return FALSE;
+}
+
+void renderPreviewWorker(RenderJob *job)
+{
+    updateImageWithSettings(job->image, job->imageSource, &job->settings, job->appData->defaultSettings, &job->lookUpTable[0][0], &job->tonesLookUpTable[0], &job->scopes, job->progress.get());
+    g_idle_add(finishRendering, job);
+}
+
+// Render podglądu z aktualnymi ustawieniami bez zapisu w historii (np. podczas przeciągania punktu krzywej)
+void renderPreview(AppData *appData)
+{
+    if(appData->imagePreview.empty())
+    {
+        return;
+    }
+
+    // Poprzedni render podglądu (jeśli jeszcze trwa) jest już nieaktualny
+    cancelRendering(appData);
+
+    // Ten sam render jest już zapamiętany, razem z histogramami
+    uint64_t hash = settingsHash(appData->userSettings);
+    if(findCachedRender(appData, hash))
+    {
+        appData->displayedSettings = *appData->userSettings;
+        appData->scopesReady = true;
+        displayImage(appData);
+        gtk_widget_queue_draw(*appData->scopesArea);
+        return;
+    }
+
+    // Transformowanie podglądu zdjęcia w osobnym wątku
+    RenderJob *job = new RenderJob();
+    job->appData = appData;
+    job->progress = make_shared<RenderProgress>();
+    job->hash = hash;
+    job->settings = *appData->userSettings;
+    job->imageSource = appData->imagePreview;
+    appData->renderProgress = job->progress;
+
+    if(!appData->renderProgressShown)
+    {
+        appData->renderProgressShown = true;
+        g_timeout_add(RENDER_PROGRESS_INTERVAL, updateRenderProgress, appData);
+    }
+
+    startWorker(appData, [job]() { renderPreviewWorker(job); });
+}
+
+void applySettings(GtkWidget *widget, gpointer data)
+{
+    AppData *appData = (AppData *)data;
+
+    if(appData->imagePreview.empty())
+    {
+        return;
+    }
+
+    recordHistory(appData);
+    renderPreview(appData);
+}
+
+gboolean pulseLoadingProgress(gpointer data)
+{
+    AppData *appData = (AppData *)data;
+
+    if(!appData->loading)
+    {
+        gtk_widget_hide(*appData->loadingProgress);
+        return FALSE;
+    }
+    gtk_progress_bar_pulse(GTK_PROGRESS_BAR(*appData->loadingProgress));
+    return TRUE;
+}
+
+// Wyświetlenie szybkiego podglądu (zdekodowanego w zmniejszonej rozdzielczości) zanim wczyta się całe zdjęcie
+gboolean showQuickPreview(gpointer data)
+{
+    LoadJob *job = (LoadJob *)data;
+    AppData *appData = job->appData;
+
+    if(job->generation == appData->loadGeneration && appData->loading)
+    {
+        appData->imagePreview = job->imagePreview;
+        appData->image = job->imagePreview;
+        displayImage(appData);
+    }
+
+    delete job;
+    return FALSE;
+}
+
+// Podmiana zdjęcia po zakończeniu wczytywania, wykonywana w wątku interfejsu
+gboolean finishLoading(gpointer data)
+{
+    LoadJob *job = (LoadJob *)data;
+    AppData *appData = job->appData;
+
+    if(job->generation == appData->loadGeneration)
+    {
+        appData->loading = false;
+
+        if(!job->success)
+        {
+            cout << "Nie można otworzyć pliku!" << endl;
+        }
+        else
+        {
+            appData->imageOriginal = job->imageOriginal;
+            appData->imagePreview = job->imagePreview;
+            appData->imagePyramid = job->imagePyramid;
+            appData->imageCache = job->imageCache;
+            appData->image = appData->imagePreview.clone();
+            appData->displayedSettings = *appData->defaultSettings;
+            clearCachedRenders(appData);
+
+            if(appData->applyAfterLoading)
+            {
+                appData->applyAfterLoading = false;
+                applySettings(NULL, appData);
+            }
+            else
+            {
+                displayImage(appData);
+            }
+        }
+    }
+
+    delete job;
+    return FALSE;
+}
+
+// Przekazanie podglądu do wyświetlenia w wątku interfejsu, zanim zdjęcie zostanie w pełni przygotowane
+void showQuickPreviewLater(AppData *appData, int generation, Mat imagePreview)
+{
+    LoadJob *quickJob = new LoadJob();
+    quickJob->appData = appData;
+    quickJob->generation = generation;
+    quickJob->imagePreview = imagePreview;
+    g_idle_add(showQuickPreview, quickJob);
+}
+
+// Dekodowanie w osobnym wątku: najpierw szybki podgląd (dla JPEG w 1/8 rozdzielczości), potem pełne zdjęcie, podgląd i piramida
+// Przed każdym etapem sprawdzane jest, czy w międzyczasie nie wybrano innego pliku
+void loadImageWorker(LoadJob *job)
+{
+    AppData *appData = job->appData;
+
+    // Zdjęcie z pamięci podręcznej: piramida i podgląd (ostatni poziom) są od razu gotowe
+    vector<Mat> cachedLevels;
+    if(loadFromCache(&job->filename, cachedLevels, job->imageCache))
+    {
+        job->success = true;
+        job->imageOriginal = cachedLevels[0];
+        job->imagePreview = cachedLevels.back();
+        job->imagePyramid.assign(cachedLevels.begin(), cachedLevels.end() - 1);
+        g_idle_add(finishLoading, job);
+        return;
+    }
+
+    // Szybkie dekodowanie w 1/8 rozdzielczości jest tańsze tylko dla JPEG (skalowanie w dekoderze DCT),
+    // inne formaty są dekodowane w całości, więc dla nich szybki podgląd powstaje z pełnego zdjęcia poniżej
+    string extension = fileExtension(&job->filename);
+    bool jpeg = extension == "jpg" || extension == "jpeg";
+    if(jpeg)
+    {
+        Mat imageQuick = imread(job->filename, IMREAD_REDUCED_COLOR_8);
+        if(!imageQuick.empty() && job->generation == appData->loadGeneration)
+        {
+            showQuickPreviewLater(appData, job->generation, imageQuick);
+        }
+    }
+
+    if(job->generation == appData->loadGeneration)
+    {
+        Mat image;
+        job->success = openFile(image, job->imageOriginal, &job->filename);
+    }
+
+    if(!job->success || job->generation != appData->loadGeneration)
+    {
+        g_idle_add(finishLoading, job);
+        return;
+    }
+
+    createPreview(job->imageOriginal, job->imagePreview);
+    if(!jpeg)
+    {
+        showQuickPreviewLater(appData, job->generation, job->imagePreview);
+    }
+    createPyramid(job->imageOriginal, job->imagePyramid);
+
+    // Zapis do pamięci podręcznej już po przekazaniu zdjęcia do interfejsu (job jest wtedy usuwany w wątku interfejsu)
+    string filename = job->filename;
+    vector<Mat> levelsToCache = job->imagePyramid;
+    levelsToCache.push_back(job->imagePreview);
+    g_idle_add(finishLoading, job);
+
+    saveToCache(&filename, levelsToCache);
+}
+
+void loadImage(GtkWidget *widget, gpointer data)
+{
+    AppData *appData = (AppData *)data;
+
+    string filename = gtk_file_chooser_get_filename((GtkFileChooser *)widget);
+    *appData->imageName = filename;
+
+    // Zdjęcie poprzednio wczytywane (jeśli jest) zostanie odrzucone po zakończeniu dekodowania
+    LoadJob *job = new LoadJob();
+    job->appData = appData;
+    job->generation = ++appData->loadGeneration;
+    job->filename = filename;
+
+    cancelRendering(appData);
+    cancelZoomRendering(appData);
+    appData->imageOriginal = Mat();
+    appData->imagePyramid.clear();
+    appData->zoom = 0.0;
+    appData->zoomImage = Mat();
+    appData->scopesReady = false;
+    gtk_widget_queue_draw(*appData->scopesArea);
+
+    if(!appData->loading)
+    {
+        appData->loading = true;
+        gtk_widget_show(*appData->loadingProgress);
+        g_timeout_add(LOADING_PULSE_INTERVAL, pulseLoadingProgress, appData);
+    }
+
+    startWorker(appData, [job]() { loadImageWorker(job); });
+}
+
+void autoSettings(GtkWidget *widget, gpointer data)
+{
+    AppData *appData = (AppData *)data;
+
+    if(!appData->imagePreview.empty())
+    {
+        autoAdjustSettings(appData->imagePreview, appData->userSettings, NULL);
+        refreshButtonLabels(appData);
+        applySettings(NULL, appData);
+    }
+}
+
+// Przywrócenie ustawień z historii, bez zapisywania tego kroku jako nowej zmiany
+void restoreSettings(AppData *appData, Settings settings)
+{
+    *appData->userSettings = settings;
+    appData->appliedSettings = settings;
+    refreshButtonLabels(appData);
+    applySettings(NULL, appData);
+}
+
+void undoSettings(GtkWidget *widget, gpointer data)
+{
+    AppData *appData = (AppData *)data;
+
+    if(appData->undoHistory.size() > 0)
+    {
+        appData->redoHistory.push_back(appData->appliedSettings);
+        Settings settings = appData->undoHistory.back();
+        appData->undoHistory.pop_back();
+        restoreSettings(appData, settings);
+    }
+}
+
+void redoSettings(GtkWidget *widget, gpointer data)
+{
+    AppData *appData = (AppData *)data;
+
+    if(appData->redoHistory.size() > 0)
+    {
+        appData->undoHistory.push_back(appData->appliedSettings);
+        Settings settings = appData->redoHistory.back();
+        appData->redoHistory.pop_back();
+        restoreSettings(appData, settings);
+    }
+}
+
+void resetSettings(GtkWidget *widget, gpointer data)
+{
+    AppData *appData = (AppData *)data;
+
+    *appData->userSettings = (Settings)*appData->defaultSettings;
+    refreshButtonLabels(appData);
+    applySettings(NULL, appData);
+}
+
+void displayOriginalImage(GtkWidget *widget, gpointer data)
+{
+    AppData *appData = (AppData *)data;
+
+    appData->displayOriginalPhoto = !(appData->displayOriginalPhoto);
+    displayImage(appData);
+}
+
+void exportFile(GtkWidget *widget, gpointer data)
+{
+    AppData *appData = (AppData *)data;
+
+    if(appData->imageOriginal.empty())
+    {
+        cout << "Zdjęcie nie zostało jeszcze wczytane!" << endl;
+        return;
+    }
+    
+    GtkWidget *fileChooserDialog;
+    fileChooserDialog = gtk_file_chooser_dialog_new("Eksportuj plik", NULL, GTK_FILE_CHOOSER_ACTION_SAVE, GTK_STOCK_CANCEL, GTK_RESPONSE_CANCEL, GTK_STOCK_SAVE, GTK_RESPONSE_ACCEPT, NULL);
+    
+    gtk_file_chooser_set_filename (GTK_FILE_CHOOSER(fileChooserDialog), (*appData->imageName).c_str());
+
+    if (gtk_dialog_run (GTK_DIALOG (fileChooserDialog)) == GTK_RESPONSE_ACCEPT)
     {
-        widthFloat = (float)appData->image.cols * ((float)appData->imageSizeHeight / (float)appData->image.rows);
-        if(widthFloat > (float)appData->imageSizeWidth)
+        appData->userSettings->outputPath = gtk_file_chooser_get_filename (GTK_FILE_CHOOSER (fileChooserDialog));
+
+        // Podgląd ma zmniejszoną rozdzielczość, więc do eksportu zdjęcie jest renderowane ponownie w pełnej rozdzielczości
+        Mat imageExport;
+        updateImageWithSettings(imageExport, appData->imageOriginal, appData->userSettings, appData->defaultSettings, appData->lookUpTable, appData->tonesLookUpTable, NULL, NULL);
+
+        if( !saveFile(imageExport, &appData->userSettings->outputPath, &appData->userSettings->exportProfile, appData->userSettings->sharpen))
         {
-            widthFloat = (float)appData->imageSizeWidth;
+            cout << "Nie udało się wyeksportować pliku!" << endl;
         }
-        heightFloat = (float)appData->image.rows * (widthFloat / (float)appData->image.cols);
+        
+        cout << appData->userSettings->outputPath << endl;
     }
-
-    *width = (int)widthFloat - (2 * IMAGE_CONTAINER_MARGIN);
-    *height = (int)heightFloat - (2 * IMAGE_CONTAINER_MARGIN);
+    gtk_widget_destroy(fileChooserDialog);
 }
 
-void insertPixelToPixbuf(GdkPixbuf *pixbuf, int x, int y, guchar red, guchar green, guchar blue)
+// Eksport wielu plików naraz według specyfikacji wpisanej w polu obok przycisku
+void exportSpecFiles(GtkWidget *widget, gpointer data)
 {
-    int rowstride, n_channels;
-    guchar *pixels, *p;
+    AppData *appData = (AppData *)data;
+    vector<ExportOutput> outputs;
 
-    n_channels = gdk_pixbuf_get_n_channels(pixbuf);
+    if(appData->imageOriginal.empty())
+    {
+        cout << "Zdjęcie nie zostało jeszcze wczytane!" << endl;
+        return;
+    }
 
-    rowstride = gdk_pixbuf_get_rowstride(pixbuf);
-    pixels = gdk_pixbuf_get_pixels(pixbuf);
+    appData->userSettings->exportSpec = gtk_entry_get_text(GTK_ENTRY(*appData->exportSpecEntry));
+    if(!parseExportSpec(appData->userSettings->exportSpec, outputs))
+    {
+        return;
+    }
 
-    p = pixels + y * rowstride + x * n_channels;
-    p[0] = red;
-    p[1] = green;
-    p[2] = blue;
+    if( !gradeAndExport(appData->imagePyramid, outputs, appData->userSettings, appData->defaultSettings, appData->lookUpTable, appData->tonesLookUpTable))
+    {
+        cout << "Nie udało się wyeksportować wszystkich plików!" << endl;
+    }
 }
 
-GdkPixbuf * convertMatPixbuf(AppData *appData, GdkPixbuf *pixbuf)
+// Rysowanie histogramów RGB (lewa połowa) i waveformu luminacji (prawa połowa) z danych zebranych podczas renderu
+gboolean drawScopes(GtkWidget *widget, GdkEventExpose *event, gpointer data)
 {
-    Mat imageTemp;
-    int width, height;
-
-    calculateImageSize(appData, &width, &height);
+    AppData *appData = (AppData *)data;
+    Scopes *scopes = &appData->scopes;
+    int width = widget->allocation.width;
+    int height = widget->allocation.height;
+    int histogramWidth = width / 2;
 
-    pixbuf = gdk_pixbuf_new(GDK_COLORSPACE_RGB, false, 8, width, height);
+    cairo_t *cairo = gdk_cairo_create(widget->window);
+    cairo_set_source_rgb(cairo, 0.1, 0.1, 0.1);
+    cairo_paint(cairo);
 
-    // Jeśli jest wciśnięty przycisk "Podejrzyj oryginał" załaduj oryginalne zdjęcie
-    if(appData->displayOriginalPhoto)
-    {        
-        resize(appData->imageOriginal, imageTemp, Size(width, height), 0, 0, INTER_AREA);
-    }
-    else
+    if(appData->scopesReady)
     {
-        resize(appData->image, imageTemp, Size(width, height), 0, 0, INTER_AREA);
-    }
+        // Histogram skalowany do najwyższego słupka pomijając skrajne wartości, które zwykle są przepalone
+        unsigned int histogramMax = 1;
+        for(int i = 0; i <= 2; i++)
+        {
+            for(int level = 1; level < 255; level++)
+            {
+                histogramMax = max(histogramMax, scopes->histogram[i][level]);
+            }
+        }
 
-    for(int y = 0; y < imageTemp.rows; y++)
+        double channelColors[3][3] = {{0.3, 0.3, 1.0}, {0.3, 1.0, 0.3}, {1.0, 0.3, 0.3}};
+        cairo_set_line_width(cairo, 1.0);
+        for(int i = 0; i <= 2; i++)
         {
-            for(int x = 0; x < imageTemp.cols; x++)
+            cairo_set_source_rgba(cairo, channelColors[i][0], channelColors[i][1], channelColors[i][2], 0.8);
+            cairo_move_to(cairo, 0, height);
+            for(int level = 0; level < 256; level++)
             {
-                Vec3b color = imageTemp.at<Vec3b>(Point(x,y));
-                insertPixelToPixbuf(pixbuf, x, y, color[RED], color[GREEN], color[BLUE]);
+                double value = min(1.0, (double)scopes->histogram[i][level] / histogramMax);
+                cairo_line_to(cairo, level * histogramWidth / 255.0, height - value * height);
             }
+            cairo_stroke(cairo);
         }
 
-    return pixbuf;
-}
+        // Waveform rysowany jako mały pixbuf rozciągnięty na prawą połowę
+        unsigned int waveformMax = 1;
+        for(int column = 0; column < WAVEFORM_COLUMNS; column++)
+        {
+            for(int level = 0; level < 256; level++)
+            {
+                waveformMax = max(waveformMax, scopes->waveform[column][level]);
+            }
+        }
 
+        GdkPixbuf *waveformPixbuf = gdk_pixbuf_new(GDK_COLORSPACE_RGB, false, 8, WAVEFORM_COLUMNS, 256);
+        int rowstride = gdk_pixbuf_get_rowstride(waveformPixbuf);
+        guchar *pixels = gdk_pixbuf_get_pixels(waveformPixbuf);
 
-// ------------------------------------------
-//  FUNKCJE OBSŁUGUJĄCE INTERFEJST GRAFICZNY
-// ------------------------------------------
+        for(int column = 0; column < WAVEFORM_COLUMNS; column++)
+        {
+            for(int level = 0; level < 256; level++)
+            {
+                guchar value = 255.0 * sqrt((double)scopes->waveform[column][level] / waveformMax);
+                guchar *p = pixels + (255 - level) * rowstride + column * 3;
+                p[0] = value;
+                p[1] = value;
+                p[2] = value;
+            }
+        }
 
-void saveButtonValueInt(GtkWidget *widget, gpointer data)
-{
-    double buttonValue = gtk_spin_button_get_value((GtkSpinButton *)widget);
-    *(int *)data = (int)buttonValue;
+        cairo_save(cairo);
+        cairo_translate(cairo, histogramWidth, 0);
+        cairo_scale(cairo, (double)(width - histogramWidth) / WAVEFORM_COLUMNS, (double)height / 256.0);
+        gdk_cairo_set_source_pixbuf(cairo, waveformPixbuf, 0, 0);
+        cairo_paint(cairo);
+        cairo_restore(cairo);
+
+        g_object_unref(waveformPixbuf);
+    }
+
+    cairo_destroy(cairo);
+    return FALSE;
 }
 
-void saveButtonValueFloat(GtkWidget *widget, gpointer data)
+// Rysowanie krzywej wybranego kanału (z wypełnionej tablicy) oraz jej punktów kontrolnych
+gboolean drawCurve(GtkWidget *widget, GdkEventExpose *event, gpointer data)
 {
-    double buttonValue = gtk_spin_button_get_value((GtkSpinButton *)widget);
-    *(float *)data = (float)buttonValue;
+    AppData *appData = (AppData *)data;
+    int channel = appData->curveChannel;
+    ToneCurve *curve = &appData->userSettings->curves[channel];
+    unsigned char *curveTable = appData->userSettings->curveTable[channel];
+    double width = widget->allocation.width - 1;
+    double height = widget->allocation.height - 1;
+
+    cairo_t *cairo = gdk_cairo_create(widget->window);
+    cairo_set_source_rgb(cairo, 0.1, 0.1, 0.1);
+    cairo_paint(cairo);
+
+    // Siatka co ćwiartkę zakresu
+    cairo_set_line_width(cairo, 1.0);
+    cairo_set_source_rgb(cairo, 0.25, 0.25, 0.25);
+    for(int i = 1; i < 4; i++)
+    {
+        cairo_move_to(cairo, i * width / 4.0 + 0.5, 0);
+        cairo_line_to(cairo, i * width / 4.0 + 0.5, height);
+        cairo_move_to(cairo, 0, i * height / 4.0 + 0.5);
+        cairo_line_to(cairo, width, i * height / 4.0 + 0.5);
+    }
+    cairo_stroke(cairo);
+
+    double channelColors[4][3] = {{0.3, 0.3, 1.0}, {0.3, 1.0, 0.3}, {1.0, 0.3, 0.3}, {0.9, 0.9, 0.9}};
+    cairo_set_source_rgb(cairo, channelColors[channel][0], channelColors[channel][1], channelColors[channel][2]);
+    cairo_set_line_width(cairo, 1.5);
+    cairo_move_to(cairo, 0, height - curveTable[0] * height / 255.0);
+    for(int value = 1; value < 256; value++)
+    {
+        cairo_line_to(cairo, value * width / 255.0, height - curveTable[value] * height / 255.0);
+    }
+    cairo_stroke(cairo);
+
+    for(int point = 0; point < curve->count; point++)
+    {
+        cairo_arc(cairo, curve->x[point] * width / 255.0, height - curve->y[point] * height / 255.0, point == appData->curvePoint ? 4.0 : 3.0, 0, 2 * M_PI);
+        cairo_fill(cairo);
+    }
+
+    cairo_destroy(cairo);
+    return FALSE;
 }
 
-void showOnButtonInt(GObject *button, gpointer value)
+// Przeliczenie położenia myszy na wartości krzywej (0-255)
+void curveCoordinates(GtkWidget *widget, double x, double y, int *curveX, int *curveY)
 {
-    int *valueInt = (int *)value;
-    double valueDouble = (double)*valueInt;
-    gtk_spin_button_set_value((GtkSpinButton *)button, valueDouble);
+    *curveX = valueInRange(lround(x * 255.0 / max(1, widget->allocation.width - 1)));
+    *curveY = valueInRange(lround((widget->allocation.height - 1 - y) * 255.0 / max(1, widget->allocation.height - 1)));
 }
 
-void showOnButtonFloat(GObject *button, gpointer value)
+// Lewy przycisk chwyta punkt (lub dodaje nowy), prawy usuwa punkt
+gboolean pressCurve(GtkWidget *widget, GdkEventButton *event, gpointer data)
 {
-    float *valueFloat = (float *)value;
-    double valueDouble = (double)*valueFloat;
-    gtk_spin_button_set_value((GtkSpinButton *)button, valueDouble);
-}
+    AppData *appData = (AppData *)data;
+    int channel = appData->curveChannel;
+    ToneCurve *curve = &appData->userSettings->curves[channel];
+    unsigned char *curveTable = appData->userSettings->curveTable[channel];
+    int x, y;
 
-void refreshButtonLabels(AppData *appData)
-{ 
-    gtk_file_chooser_set_filename((GtkFileChooser *)*appData->chooseFileButton, (*appData->imageName).c_str());
-    showOnButtonInt(*appData->brightnessButton, &appData->userSettings->brightness);
-    showOnButtonInt(*appData->contrastButton, &appData->userSettings->contrast);
-    showOnButtonFloat(*appData->exposureButton, &appData->userSettings->exposure);
-    showOnButtonFloat(*appData->saturationButton, &appData->userSettings->saturation);
-    showOnButtonInt(*appData->temperatureButton, &appData->userSettings->colorTemperature);
-    showOnButtonInt(*appData->hueRedButton, &appData->userSettings->hue[RED]);
-    showOnButtonInt(*appData->hueGreenButton, &appData->userSettings->hue[GREEN]);
-    showOnButtonInt(*appData->hueBlueButton, &appData->userSettings->hue[BLUE]);
-    showOnButtonInt(*appData->liftButton, &appData->userSettings->lift);
-    showOnButtonFloat(*appData->gammaButton, &appData->userSettings->gamma);
-    showOnButtonFloat(*appData->gainButton, &appData->userSettings->gain);
-    showOnButtonFloat(*appData->shadowsButton, &appData->userSettings->shadows);
-    showOnButtonFloat(*appData->midtonesButton, &appData->userSettings->midtones);
-    showOnButtonFloat(*appData->highlightsButton, &appData->userSettings->highlights);
-}
+    curveCoordinates(widget, event->x, event->y, &x, &y);
 
-void displayImage(AppData *appData)
-{
-    // Jeśli zdjęcie zostało wczytane to można je wyświetlić
-    if(appData->imageName->size() > 0)
+    int nearest = -1;
+    for(int point = 0; point < curve->count; point++)
     {
-        GdkPixbuf *pixbuf;
-
-        // Konwersja Mat na Pixbuf
-        pixbuf = convertMatPixbuf(appData, pixbuf);
+        double distanceX = (curve->x[point] - x) * (widget->allocation.width - 1) / 255.0;
+        double distanceY = (curve->y[point] - y) * (widget->allocation.height - 1) / 255.0;
+        if(distanceX * distanceX + distanceY * distanceY <= CURVE_GRAB_DISTANCE * CURVE_GRAB_DISTANCE)
+        {
+            nearest = point;
+        }
+    }
 
-        // Wyświetlenie Pixbuf
-        gtk_image_set_from_pixbuf((GtkImage *)*appData->imageContainer, pixbuf);
+    if(event->button == 3)
+    {
+        if(nearest >= 0)
+        {
+            removeCurvePoint(curve, curveTable, nearest);
+            gtk_widget_queue_draw(widget);
+            applySettings(NULL, appData);
+        }
+        return TRUE;
+    }
 
-        // Zwalnianie pamięci
-        g_object_unref(pixbuf);
+    appData->curvePoint = nearest >= 0 ? nearest : insertCurvePoint(curve, curveTable, x, y);
+    if(appData->curvePoint >= 0 && nearest < 0)
+    {
+        renderPreview(appData);
     }
+    gtk_widget_queue_draw(widget);
+    return TRUE;
+}
 
+// Podczas przeciągania tablica krzywej jest uzupełniana tylko w zmienionych odcinkach, a podgląd renderowany bez zapisu w historii
+gboolean dragCurve(GtkWidget *widget, GdkEventMotion *event, gpointer data)
+{
+    AppData *appData = (AppData *)data;
+    int channel = appData->curveChannel;
+    int x, y;
+
+    if(appData->curvePoint >= 0 && (event->state & GDK_BUTTON1_MASK))
+    {
+        curveCoordinates(widget, event->x, event->y, &x, &y);
+        moveCurvePoint(&appData->userSettings->curves[channel], appData->userSettings->curveTable[channel], appData->curvePoint, x, y);
+        gtk_widget_queue_draw(widget);
+        renderPreview(appData);
+    }
+    return TRUE;
 }
 
-void loadImage(GtkWidget *widget, gpointer data)
+// Puszczenie punktu zapisuje całe przeciągnięcie jako jeden krok historii
+gboolean releaseCurve(GtkWidget *widget, GdkEventButton *event, gpointer data)
 {
     AppData *appData = (AppData *)data;
 
-    string filename = gtk_file_chooser_get_filename((GtkFileChooser *)widget);
-    *appData->imageName = filename;
-    
-    if( !openFile(appData->image, appData->imageOriginal, appData->imageName) )
+    if(appData->curvePoint >= 0)
     {
-        cout << "Nie można otworzyć pliku!" << endl;
+        appData->curvePoint = -1;
+        gtk_widget_queue_draw(widget);
+        applySettings(NULL, appData);
     }
-    else
+    return TRUE;
+}
+
+void selectCurveChannel(GtkWidget *widget, gpointer data)
+{
+    AppData *appData = (AppData *)data;
+
+    if(gtk_toggle_button_get_active(GTK_TOGGLE_BUTTON(widget)))
     {
-        displayImage(appData);
+        appData->curveChannel = GPOINTER_TO_INT(g_object_get_data(G_OBJECT(widget), "curveChannel"));
+        appData->curvePoint = -1;
+        gtk_widget_queue_draw(*appData->curveArea);
     }
 }
 
-void getImageContainerSize(GtkWidget *widget, GtkAllocation *allocation, void *data)
+// Przyciski nasycenia i jasności pokazują i zmieniają ustawienia zakresu barw wybranego przełącznikiem
+void selectHslBand(GtkWidget *widget, gpointer data)
 {
     AppData *appData = (AppData *)data;
 
-    if(allocation->width != appData->imageSizeWidth || allocation->height != appData->imageSizeHeight)
+    if(gtk_toggle_button_get_active(GTK_TOGGLE_BUTTON(widget)))
     {
-        appData->imageSizeWidth = allocation->width;
-        appData->imageSizeHeight = allocation->height;
-        
-        if(appData->imageName->size() > 0)
-        {
-            displayImage(appData);
-        }
+        appData->hslBand = GPOINTER_TO_INT(g_object_get_data(G_OBJECT(widget), "hslBand"));
+        showOnButtonFloat(*appData->hslSaturationButton, &appData->userSettings->hslSaturation[appData->hslBand]);
+        showOnButtonFloat(*appData->hslLuminanceButton, &appData->userSettings->hslLuminance[appData->hslBand]);
     }
 }
 
-void applySettings(GtkWidget *widget, gpointer data)
+void saveHslSaturation(GtkWidget *widget, gpointer data)
 {
     AppData *appData = (AppData *)data;
+    saveButtonValueFloat(widget, &appData->userSettings->hslSaturation[appData->hslBand]);
+}
 
-    // Transformowanie zdjęcia
-    updateImageWithSettings(appData->image, appData->imageOriginal, appData->userSettings, appData->defaultSettings, appData->lookUpTable, appData->tonesLookUpTable);
+void saveHslLuminance(GtkWidget *widget, gpointer data)
+{
+    AppData *appData = (AppData *)data;
+    saveButtonValueFloat(widget, &appData->userSettings->hslLuminance[appData->hslBand]);
+}
+
+// Przełączanie między dopasowaniem do okna a powiększeniem 1:1 na środku zdjęcia
+void toggleZoom(GtkWidget *widget, gpointer data)
+{
+    AppData *appData = (AppData *)data;
+
+    if(appData->imagePyramid.empty())
+    {
+        return;
+    }
 
+    appData->zoom = appData->zoom == 1.0 ? 0.0 : 1.0;
+    appData->panX = 0.5;
+    appData->panY = 0.5;
     displayImage(appData);
 }
 
-void resetSettings(GtkWidget *widget, gpointer data)
+// Kółko myszy powiększa lub pomniejsza podgląd dwukrotnie, poniżej dopasowania do okna wraca do widoku całego zdjęcia
+gboolean scrollZoom(GtkWidget *widget, GdkEventScroll *event, gpointer data)
 {
     AppData *appData = (AppData *)data;
 
-    *appData->userSettings = (Settings)*appData->defaultSettings;
-    refreshButtonLabels(appData);
-    applySettings(NULL, appData);
+    if(appData->imagePyramid.empty())
+    {
+        return FALSE;
+    }
+
+    float fitZoom = calculateFitZoom(appData);
+    float zoom = appData->zoom > 0.0 ? appData->zoom : fitZoom;
+
+    if(event->direction == GDK_SCROLL_UP)
+    {
+        appData->zoom = min((float)ZOOM_MAX, zoom * 2.0f);
+    }
+    else if(event->direction == GDK_SCROLL_DOWN)
+    {
+        appData->zoom = zoom / 2.0 <= fitZoom ? 0.0 : zoom / 2.0;
+    }
+
+    displayImage(appData);
+    return TRUE;
 }
 
-void displayOriginalImage(GtkWidget *widget, gpointer data)
+gboolean startPan(GtkWidget *widget, GdkEventButton *event, gpointer data)
 {
     AppData *appData = (AppData *)data;
 
-    appData->displayOriginalPhoto = !(appData->displayOriginalPhoto);
-    displayImage(appData);
+    appData->dragX = event->x;
+    appData->dragY = event->y;
+    return FALSE;
 }
 
-void exportFile(GtkWidget *widget, gpointer data)
+// Przeciąganie myszą przesuwa widoczny wycinek (środek zapamiętywany jako ułamek wymiarów zdjęcia)
+gboolean pan(GtkWidget *widget, GdkEventMotion *event, gpointer data)
 {
     AppData *appData = (AppData *)data;
-    
-    GtkWidget *fileChooserDialog;
-    fileChooserDialog = gtk_file_chooser_dialog_new("Eksportuj plik", NULL, GTK_FILE_CHOOSER_ACTION_SAVE, GTK_STOCK_CANCEL, GTK_RESPONSE_CANCEL, GTK_STOCK_SAVE, GTK_RESPONSE_ACCEPT, NULL);
-    
-    gtk_file_chooser_set_filename (GTK_FILE_CHOOSER(fileChooserDialog), (*appData->imageName).c_str());
 
-    if (gtk_dialog_run (GTK_DIALOG (fileChooserDialog)) == GTK_RESPONSE_ACCEPT)
+    if(appData->zoom > 0.0 && (event->state & GDK_BUTTON1_MASK))
     {
-        appData->userSettings->outputPath = gtk_file_chooser_get_filename (GTK_FILE_CHOOSER (fileChooserDialog));
-
-        if( !saveFile(appData->image, &appData->userSettings->outputPath))
-        {
-            cout << "Nie udało się wyeksportować pliku!" << endl;
-        }
-        
-        cout << appData->userSettings->outputPath << endl;
+        appData->panX = min(1.0, max(0.0, appData->panX - (event->x - appData->dragX) / (appData->zoom * appData->imageOriginal.cols)));
+        appData->panY = min(1.0, max(0.0, appData->panY - (event->y - appData->dragY) / (appData->zoom * appData->imageOriginal.rows)));
+        appData->dragX = event->x;
+        appData->dragY = event->y;
+        displayImage(appData);
     }
-    gtk_widget_destroy(fileChooserDialog);
+    return TRUE;
 }
 
 void closeWindow(GtkWidget *widget, gpointer data)
@@ -586,6 +4853,9 @@ void closeWindow(GtkWidget *widget, gpointer data)
 
 int main( int argc, char** argv )
 {
+    // Wszystkie bufory Mat (rendery, podglądy, eksport) pobierane są z puli
+    Mat::setDefaultAllocator(bufferPool());
+
     // Inicjalizacja zmiennych
     Mat image;
     Mat imageOriginal;
@@ -595,36 +4865,110 @@ int main( int argc, char** argv )
     float tonesLookUpTable[256];
     String imageName;
 
-    // Odczyt flag z linii poleceń
+    // Odczyt flag z linii poleceń, pierwszym argumentem może być zdjęcie
     if( argc > 1)
     {
-        imageName = argv[1];
-        for(int i = 2; i < argc; i++)
-        {
-            if( checkArgumentInt(&argv[0], &argc, i, "-b", &userSettings.brightness, -256, 256) ) return 1;
-            if( checkArgumentInt(&argv[0], &argc, i, "-c", &userSettings.contrast, -256, 256) ) return 1;
-            if( checkArgumentInt(&argv[0], &argc, i, "-t", &userSettings.colorTemperature, -256, 256) ) return 1;
-            if( checkArgumentInt(&argv[0], &argc, i, "-hr", &userSettings.hue[RED], -256, 256) ) return 1;
-            if( checkArgumentInt(&argv[0], &argc, i, "-hg", &userSettings.hue[GREEN], -256, 256) ) return 1;
-            if( checkArgumentInt(&argv[0], &argc, i, "-hb", &userSettings.hue[BLUE], -256, 256) ) return 1;
-            if( checkArgumentFloat(&argv[0], &argc, i, "-e", &userSettings.exposure, -4.0, 4.0) ) return 1;
-            if( checkArgumentFloat(&argv[0], &argc, i, "-s", &userSettings.saturation, 0.0, 4.0) ) return 1;
-            if( checkArgumentInt(&argv[0], &argc, i, "-l", &userSettings.lift, -256, 256) ) return 1;
-            if( checkArgumentFloat(&argv[0], &argc, i, "-g", &userSettings.gamma, 0.0, 4.0) ) return 1;
-            if( checkArgumentFloat(&argv[0], &argc, i, "-gn", &userSettings.gain, 0.0, 2.0) ) return 1;
-            if( checkArgumentFloat(&argv[0], &argc, i, "-sh", &userSettings.shadows, -1.0, 1.0) ) return 1;
-            if( checkArgumentFloat(&argv[0], &argc, i, "-md", &userSettings.midtones, -1.0, 1.0) ) return 1;
-            if( checkArgumentFloat(&argv[0], &argc, i, "-hl", &userSettings.highlights, -1.0, 1.0) ) return 1;
-            if( checkArgumentString(&argv[0], &argc, i, "-o", &userSettings.outputPath) ) return 1;
+        int firstFlag = 1;
+        if(argv[1][0] != '-')
+        {
+            imageName = argv[1];
+            firstFlag = 2;
+        }
+        if( readArguments(argv, argc, firstFlag, &userSettings) ) return 1;
+
+        // Flagi z linii poleceń mają pierwszeństwo przed presetem
+        if(userSettings.presetPath.size() > 0)
+        {
+            if( readPresetFile(&userSettings.presetPath, &userSettings) ) return 1;
+            if( readArguments(argv, argc, firstFlag, &userSettings) ) return 1;
+        }
+
+        // Ustawienia drugiej transformacji, mieszanej według maski
+        if(userSettings.maskPresetPath.size() > 0)
+        {
+            shared_ptr<Settings> maskGrade = make_shared<Settings>();
+            if( readPresetFile(&userSettings.maskPresetPath, maskGrade.get()) ) return 1;
+            // Odszumianie działa na całym zdjęciu przed transformacją, więc nie da się go mieszać według maski
+            if(maskGrade->denoise != defaultSettings.denoise)
+            {
+                cout << "Odszumianie (-dn) nie jest obsługiwane w presecie maski!" << endl;
+                return 1;
+            }
+            userSettings.maskGrade = maskGrade;
+        }
+        if(userSettings.mask.type != MASK_NONE && !userSettings.maskGrade)
+        {
+            cout << "Maska wymaga ustawień podanych przez -mask-preset!" << endl;
+            return 1;
+        }
+    }
+
+    // Tryb obserwowania katalogu
+    if(userSettings.watchDirectory.size() > 0)
+    {
+        if(userSettings.outputDirectory.size() == 0)
+        {
+            cout << "Tryb --watch wymaga katalogu wyjściowego --out!" << endl;
+            return 1;
         }
+        return watchDirectory(&userSettings, &defaultSettings);
+    }
+
+    // Zadanie wsadowe według manifestu
+    if(userSettings.batchManifest.size() > 0)
+    {
+        return runBatch(&userSettings, &defaultSettings);
     }
     
-    // Jeśli podano ścieżkę docelową jako argument następuje zapis zdjęcia do pliku bez uruchamiania interfejsu graficznego
-    if(userSettings.outputPath.size() > 0)
+    // Jeśli podano ścieżkę docelową, wzorzec lub liczbę powtórzeń benchmarku następuje praca bez uruchamiania interfejsu graficznego
+    bool fullResolutionNeeded = userSettings.outputPath.size() > 0 || userSettings.referencePath.size() > 0 || userSettings.benchmarkRuns > 0 || userSettings.encodeBenchmark;
+    if(fullResolutionNeeded || userSettings.exportSpec.size() > 0)
     {
+        vector<ExportOutput> outputs;
+        if(userSettings.exportSpec.size() > 0 && !parseExportSpec(userSettings.exportSpec, outputs)) return 1;
+
         if( !openFile(image, imageOriginal, &imageName) ) return 1;
-        updateImageWithSettings(image, imageOriginal, &userSettings, &defaultSettings, &lookUpTable[0][0], &tonesLookUpTable[0]);
-        if( !saveFile(image, &userSettings.outputPath)) return 1;
+        if(userSettings.autoAdjust)
+        {
+            autoAdjustSettings(imageOriginal, &userSettings, &defaultSettings);
+        }
+
+        // Sam eksport według specyfikacji nie wymaga transformowania zdjęcia w pełnej rozdzielczości
+        if(!fullResolutionNeeded)
+        {
+            vector<Mat> imagePyramid(1, imageOriginal);
+            bool success = gradeAndExport(imagePyramid, outputs, &userSettings, &defaultSettings, &lookUpTable[0][0], &tonesLookUpTable[0]);
+            if(userSettings.poolStats)
+            {
+                printBufferPoolStats();
+            }
+            return success ? 0 : 1;
+        }
+
+        if(userSettings.benchmarkRuns > 0)
+        {
+            if( !benchmarkSettings(image, imageOriginal, &userSettings, &defaultSettings, &lookUpTable[0][0], &tonesLookUpTable[0]) ) return 1;
+        }
+        else
+        {
+            updateImageWithProgress(image, imageOriginal, &userSettings, &defaultSettings, &lookUpTable[0][0], &tonesLookUpTable[0]);
+        }
+        if(userSettings.referencePath.size() > 0)
+        {
+            if( !compareWithReference(image, &userSettings.referencePath, userSettings.referenceTolerance) ) return 1;
+        }
+        if(userSettings.outputPath.size() > 0)
+        {
+            if( !saveFile(image, &userSettings.outputPath, &userSettings.exportProfile, userSettings.sharpen)) return 1;
+        }
+        if(outputs.size() > 0)
+        {
+            if( !exportOutputs(image, outputs, &userSettings.exportProfile, userSettings.sharpen) ) return 1;
+        }
+        if(userSettings.encodeBenchmark)
+        {
+            benchmarkEncoding(image);
+        }
     }
     // Uruchamianie interfejsu graficznego
     else
@@ -633,11 +4977,23 @@ int main( int argc, char** argv )
         GtkBuilder *builder;
         GObject *mainWindow;
         GtkWidget *imageContainer;
+        GtkWidget *imageEventBox;
+        GtkWidget *scopesArea;
+        GtkWidget *curveArea;
+        GObject *curveMasterRadio, *curveRedRadio, *curveGreenRadio, *curveBlueRadio;
+        GObject *hslRadios[HSL_BANDS];
+        const char *hslRadioNames[HSL_BANDS] = {"hslRedRadio", "hslOrangeRadio", "hslYellowRadio", "hslGreenRadio", "hslAquaRadio", "hslBlueRadio", "hslPurpleRadio", "hslMagentaRadio"};
+        GtkWidget *loadingProgress;
         GtkFileChooserButton *chooseFileButton;
         GObject *applyButton;
         GObject *resetButton;
+        GObject *autoButton;
+        GObject *undoButton, *redoButton;
         GObject *changesButton;
+        GObject *zoomButton;
         GObject *exportButton;
+        GObject *exportSpecButton;
+        GtkWidget *exportSpecEntry;
         GObject *brightnessButton;
         GObject *contrastButton;
         GObject *exposureButton;
@@ -646,6 +5002,15 @@ int main( int argc, char** argv )
         GObject *hueRedButton, *hueGreenButton, *hueBlueButton;
         GObject *liftButton, *gammaButton, *gainButton;
         GObject *shadowsButton, *midtonesButton, *highlightsButton;
+        GObject *clarityButton;
+        GObject *vignetteButton;
+        GObject *denoiseButton;
+        GObject *sharpenButton;
+        GObject *whiteBalanceButton;
+        GObject *tintButton;
+        GObject *linearLightButton;
+        GObject *hslSaturationButton;
+        GObject *hslLuminanceButton;
         GError *error = NULL;
 
         // Tworzenie struktury ze wszystkimi danymi programu oraz przypisywanie im wartości (także wskaźników na wskaźniki obiektów interfejsu)
@@ -659,6 +5024,15 @@ int main( int argc, char** argv )
         appData.imageName = &imageName;
         appData.builder = &builder;
         appData.imageContainer = &imageContainer;
+        appData.scopesArea = &scopesArea;
+        appData.curveArea = &curveArea;
+        appData.loadingProgress = &loadingProgress;
+        appData.exportSpecEntry = &exportSpecEntry;
+        appData.loadGeneration = 0;
+        if(userSettings.displayProfile.size() > 0 && !loadDisplayLut(&userSettings.displayProfile, appData.displayLut))
+        {
+            return 1;
+        }
         appData.chooseFileButton = &chooseFileButton;
         appData.brightnessButton = &brightnessButton;
         appData.contrastButton = &contrastButton;
@@ -674,6 +5048,15 @@ int main( int argc, char** argv )
         appData.shadowsButton = &shadowsButton;
         appData.midtonesButton = &midtonesButton;
         appData.highlightsButton = &highlightsButton;
+        appData.clarityButton = &clarityButton;
+        appData.vignetteButton = &vignetteButton;
+        appData.denoiseButton = &denoiseButton;
+        appData.sharpenButton = &sharpenButton;
+        appData.whiteBalanceButton = &whiteBalanceButton;
+        appData.tintButton = &tintButton;
+        appData.linearLightButton = &linearLightButton;
+        appData.hslSaturationButton = &hslSaturationButton;
+        appData.hslLuminanceButton = &hslLuminanceButton;
 
         // Inicjowanie interfejsu
         gtk_init (&argc, &argv);
@@ -690,11 +5073,29 @@ int main( int argc, char** argv )
         // Przypisywanie obiektów interfejsu do wskaźników na nie
         mainWindow = gtk_builder_get_object (builder, "mainWindow");
         imageContainer = (GtkWidget *)gtk_builder_get_object(builder, "imageContainer");
+        imageEventBox = (GtkWidget *)gtk_builder_get_object(builder, "imageEventBox");
+        scopesArea = (GtkWidget *)gtk_builder_get_object(builder, "scopesArea");
+        curveArea = (GtkWidget *)gtk_builder_get_object(builder, "curveArea");
+        curveMasterRadio = gtk_builder_get_object(builder, "curveMasterRadio");
+        curveRedRadio = gtk_builder_get_object(builder, "curveRedRadio");
+        curveGreenRadio = gtk_builder_get_object(builder, "curveGreenRadio");
+        curveBlueRadio = gtk_builder_get_object(builder, "curveBlueRadio");
+        for(int band = 0; band < HSL_BANDS; band++)
+        {
+            hslRadios[band] = gtk_builder_get_object(builder, hslRadioNames[band]);
+        }
+        loadingProgress = (GtkWidget *)gtk_builder_get_object(builder, "loadingProgress");
         chooseFileButton = (GtkFileChooserButton *)gtk_builder_get_object (builder, "chooseFileButton");
         applyButton = gtk_builder_get_object (builder, "applyButton");
         resetButton = gtk_builder_get_object (builder, "resetButton");
+        autoButton = gtk_builder_get_object (builder, "autoButton");
+        undoButton = gtk_builder_get_object (builder, "undoButton");
+        redoButton = gtk_builder_get_object (builder, "redoButton");
         changesButton = gtk_builder_get_object (builder, "changesButton");
+        zoomButton = gtk_builder_get_object (builder, "zoomButton");
         exportButton = gtk_builder_get_object (builder, "exportButton");
+        exportSpecButton = gtk_builder_get_object (builder, "exportSpecButton");
+        exportSpecEntry = (GtkWidget *)gtk_builder_get_object (builder, "exportSpecEntry");
 
         *appData.brightnessButton = gtk_builder_get_object (builder, "brightnessButton");
         *appData.contrastButton = gtk_builder_get_object (builder, "contrastButton");
@@ -710,16 +5111,53 @@ int main( int argc, char** argv )
         *appData.shadowsButton = gtk_builder_get_object (builder, "shadowsButton");
         *appData.midtonesButton = gtk_builder_get_object (builder, "midtonesButton");
         *appData.highlightsButton = gtk_builder_get_object (builder, "highlightsButton");
+        *appData.clarityButton = gtk_builder_get_object (builder, "clarityButton");
+        *appData.vignetteButton = gtk_builder_get_object (builder, "vignetteButton");
+        *appData.denoiseButton = gtk_builder_get_object (builder, "denoiseButton");
+        *appData.sharpenButton = gtk_builder_get_object (builder, "sharpenButton");
+        *appData.whiteBalanceButton = gtk_builder_get_object (builder, "whiteBalanceButton");
+        *appData.tintButton = gtk_builder_get_object (builder, "tintButton");
+        *appData.linearLightButton = gtk_builder_get_object (builder, "linearLightButton");
+        *appData.hslSaturationButton = gtk_builder_get_object (builder, "hslSaturationButton");
+        *appData.hslLuminanceButton = gtk_builder_get_object (builder, "hslLuminanceButton");
 
         // Ustawianie nasłuchu sygnałów
         g_signal_connect (mainWindow, "destroy", G_CALLBACK(closeWindow), &appData);
         g_signal_connect (imageContainer, "size-allocate", G_CALLBACK(getImageContainerSize), &appData);
+        g_signal_connect (scopesArea, "expose-event", G_CALLBACK(drawScopes), &appData);
+        g_signal_connect (curveArea, "expose-event", G_CALLBACK(drawCurve), &appData);
+        gtk_widget_add_events(curveArea, GDK_BUTTON_PRESS_MASK | GDK_BUTTON_RELEASE_MASK | GDK_BUTTON1_MOTION_MASK);
+        g_signal_connect (curveArea, "button-press-event", G_CALLBACK(pressCurve), &appData);
+        g_signal_connect (curveArea, "motion-notify-event", G_CALLBACK(dragCurve), &appData);
+        g_signal_connect (curveArea, "button-release-event", G_CALLBACK(releaseCurve), &appData);
+        g_object_set_data(curveMasterRadio, "curveChannel", GINT_TO_POINTER(CURVE_MASTER));
+        g_object_set_data(curveRedRadio, "curveChannel", GINT_TO_POINTER(RED));
+        g_object_set_data(curveGreenRadio, "curveChannel", GINT_TO_POINTER(GREEN));
+        g_object_set_data(curveBlueRadio, "curveChannel", GINT_TO_POINTER(BLUE));
+        g_signal_connect (curveMasterRadio, "toggled", G_CALLBACK(selectCurveChannel), &appData);
+        g_signal_connect (curveRedRadio, "toggled", G_CALLBACK(selectCurveChannel), &appData);
+        g_signal_connect (curveGreenRadio, "toggled", G_CALLBACK(selectCurveChannel), &appData);
+        g_signal_connect (curveBlueRadio, "toggled", G_CALLBACK(selectCurveChannel), &appData);
+        for(int band = 0; band < HSL_BANDS; band++)
+        {
+            g_object_set_data(hslRadios[band], "hslBand", GINT_TO_POINTER(band));
+            g_signal_connect (hslRadios[band], "toggled", G_CALLBACK(selectHslBand), &appData);
+        }
         g_signal_connect (chooseFileButton, "file-set", G_CALLBACK(loadImage), &appData);
         g_signal_connect (applyButton, "clicked", G_CALLBACK(applySettings), &appData);
         g_signal_connect (resetButton, "clicked", G_CALLBACK(resetSettings), &appData);
+        g_signal_connect (autoButton, "clicked", G_CALLBACK(autoSettings), &appData);
+        g_signal_connect (undoButton, "clicked", G_CALLBACK(undoSettings), &appData);
+        g_signal_connect (redoButton, "clicked", G_CALLBACK(redoSettings), &appData);
         g_signal_connect (changesButton, "pressed", G_CALLBACK(displayOriginalImage), &appData);
         g_signal_connect (changesButton, "released", G_CALLBACK(displayOriginalImage), &appData);
         g_signal_connect (exportButton, "clicked", G_CALLBACK(exportFile), &appData);
+        g_signal_connect (exportSpecButton, "clicked", G_CALLBACK(exportSpecFiles), &appData);
+        g_signal_connect (zoomButton, "clicked", G_CALLBACK(toggleZoom), &appData);
+        gtk_widget_add_events(imageEventBox, GDK_BUTTON_PRESS_MASK | GDK_BUTTON1_MOTION_MASK | GDK_SCROLL_MASK);
+        g_signal_connect (imageEventBox, "button-press-event", G_CALLBACK(startPan), &appData);
+        g_signal_connect (imageEventBox, "motion-notify-event", G_CALLBACK(pan), &appData);
+        g_signal_connect (imageEventBox, "scroll-event", G_CALLBACK(scrollZoom), &appData);
 
         g_signal_connect (brightnessButton, "value-changed", G_CALLBACK(saveButtonValueInt), &userSettings.brightness);
         g_signal_connect (contrastButton, "value-changed", G_CALLBACK(saveButtonValueInt), &userSettings.contrast);
@@ -735,6 +5173,15 @@ int main( int argc, char** argv )
         g_signal_connect (shadowsButton, "value-changed", G_CALLBACK(saveButtonValueFloat), &userSettings.shadows);
         g_signal_connect (midtonesButton, "value-changed", G_CALLBACK(saveButtonValueFloat), &userSettings.midtones);
         g_signal_connect (highlightsButton, "value-changed", G_CALLBACK(saveButtonValueFloat), &userSettings.highlights);
+        g_signal_connect (clarityButton, "value-changed", G_CALLBACK(saveButtonValueFloat), &userSettings.clarity);
+        g_signal_connect (vignetteButton, "value-changed", G_CALLBACK(saveButtonValueFloat), &userSettings.vignette);
+        g_signal_connect (denoiseButton, "value-changed", G_CALLBACK(saveButtonValueFloat), &userSettings.denoise);
+        g_signal_connect (sharpenButton, "value-changed", G_CALLBACK(saveButtonValueFloat), &userSettings.sharpen);
+        g_signal_connect (whiteBalanceButton, "value-changed", G_CALLBACK(saveButtonValueInt), &userSettings.whiteBalance);
+        g_signal_connect (tintButton, "value-changed", G_CALLBACK(saveButtonValueFloat), &userSettings.tint);
+        g_signal_connect (linearLightButton, "toggled", G_CALLBACK(saveButtonValueBool), &userSettings.linearLight);
+        g_signal_connect (hslSaturationButton, "value-changed", G_CALLBACK(saveHslSaturation), &appData);
+        g_signal_connect (hslLuminanceButton, "value-changed", G_CALLBACK(saveHslLuminance), &appData);
 
         // Zapisywanie wielkości imageContainer żeby potem dopasować do niej wielkość wyświetlanego zdjęcia
         appData.imageSizeWidth = imageContainer->allocation.width;
@@ -747,12 +5194,18 @@ int main( int argc, char** argv )
             gtk_file_chooser_set_filename((GtkFileChooser *)chooseFileButton, imageName.c_str());
             refreshButtonLabels(&appData);
 
-            // Wyświetlanie zdjęcia z zastosowanymi ustawieniami
+            // Wyświetlanie zdjęcia z zastosowanymi ustawieniami (po zakończeniu wczytywania)
+            appData.applyAfterLoading = true;
             loadImage((GtkWidget *)chooseFileButton, &appData);
-            applySettings(NULL, &appData);
         }
 
         gtk_main ();
+        joinWorkers(&appData);
+    }
+
+    if(userSettings.poolStats)
+    {
+        printBufferPoolStats();
     }
 
     return 0;
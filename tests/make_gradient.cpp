@@ -0,0 +1,60 @@
+#include <iostream>
+#include <stdlib.h>
+#include <stdint.h>
+#include <opencv2/core.hpp>
+#include <opencv2/imgcodecs.hpp>
+#include <opencv2/imgproc/imgproc.hpp>
+
+using namespace std;
+using namespace cv;
+
+// Syntetyczne zdjęcie testowe: w górnej części odcień zmienia się w poziomie, a jasność w pionie (od czerni do pełnego
+// nasycenia i bieli), w dolnej jest szary gradient od czerni do bieli, więc każda flaga zmienia widoczną część pikseli
+// Domyślny rozmiar 512 x 384 wystarcza do porównań ze wzorcami, do pomiaru wydajności podawany jest większy
+int main(int argc, char **argv)
+{
+    int width = 512, height = 384;
+    if(argc == 4)
+    {
+        width = atoi(argv[2]);
+        height = atoi(argv[3]);
+    }
+    if((argc != 2 && argc != 4) || width < 16 || height < 16)
+    {
+        cout << "Użycie: make_gradient [ścieżka.png] [szerokość wysokość]" << endl;
+        return 1;
+    }
+
+    int colorHeight = height * 5 / 6;
+    Mat image(height, width, CV_8UC3);
+
+    for(int y = 0; y < height; y++)
+    {
+        Vec3b *row = image.ptr<Vec3b>(y);
+        for(int x = 0; x < width; x++)
+        {
+            if(y < colorHeight)
+            {
+                // HSV w OpenCV: odcień 0-180, w dolnej połowie rośnie jasność, w górnej spada nasycenie
+                float position = (float)y / (colorHeight - 1);
+                uchar hue = (int64_t)x * 180 / width;
+                uchar saturation = position < 0.5f ? 255 : saturate_cast<uchar>(255.0f * (1.0f - position) * 2.0f);
+                uchar value = position < 0.5f ? saturate_cast<uchar>(255.0f * position * 2.0f) : 255;
+                row[x] = Vec3b(hue, saturation, value);
+            }
+            else
+            {
+                uchar gray = (int64_t)x * 256 / width;
+                row[x] = Vec3b(0, 0, gray);
+            }
+        }
+    }
+    cvtColor(image, image, COLOR_HSV2BGR);
+
+    if(!imwrite(argv[1], image))
+    {
+        cout << "Nie można zapisać pliku " << argv[1] << "!" << endl;
+        return 1;
+    }
+    return 0;
+}
@@ -0,0 +1,160 @@
+#!/bin/sh
+# Testy regresji: każda flaga transformacji uruchamiana jest na syntetycznym gradiencie i porównywana flagą -ref
+# z wzorcem z katalogu tests/wzorce (dopuszczalna różnica -tol 1, zmienna TOLERANCE), a na końcu sprawdzana jest wydajność
+# Brakujący wzorzec generowany jest programem zbudowanym z wersji referencyjnej przypadku (git archive i g++ jak w README),
+# a nie testowanym programem, więc wzorce podstawowych flag pochodzą z kodu sprzed optymalizacji
+# Użycie: tests/run_tests.sh [--update], gdzie --update generuje od nowa wszystkie wzorce
+# Program szukany jest w katalogu głównym repozytorium, inną ścieżkę można podać zmienną PROGRAM,
+# a CXXFLAGS to dodatkowe flagi kompilacji wersji referencyjnych (te same co przy kompilacji testowanego programu)
+
+TESTS_DIR=$(cd "$(dirname "$0")" && pwd)
+REPO_DIR=$(cd "$TESTS_DIR/.." && pwd)
+PROGRAM=${PROGRAM:-"$REPO_DIR/Color Grading Program"}
+GOLDEN_DIR="$TESTS_DIR/wzorce"
+BUILD_DIR="$TESTS_DIR/.build"
+TOLERANCE=${TOLERANCE:-1}
+UPDATE=0
+if [ "$1" = "--update" ]; then
+    UPDATE=1
+fi
+
+# Wersje referencyjne: kod sprzed optymalizacji (podstawowe flagi), pierwsze wersje klarowności i automatycznych ustawień,
+# "-" oznacza testowany program (funkcje dodane dopiero po przepisaniu pętli, bez wcześniejszej wersji)
+BASE_REVISION=':/^\[user-026\] Add reference-image'
+CLARITY_REVISION=':/^\[user-027\] Add clarity'
+AUTO_REVISION=':/^\[user-029\] Add automatic'
+
+# Wydajność: najlepszy z PERF_RUNS renderów gradientu 6000 x 4000 nie może być wolniejszy niż PERF_MARGIN
+# (domyślnie 0.9, czyli 90%) wydajności wersji bazowej zmierzonej na tym samym komputerze
+PERF_RUNS=${PERF_RUNS:-5}
+PERF_MARGIN=${PERF_MARGIN:-0.9}
+PERF_FLAGS="-c 30 -s 1.4 -e 0.3 -sh 0.4 -hl -0.3"
+
+if [ ! -x "$PROGRAM" ]; then
+    echo "Nie znaleziono programu $PROGRAM!"
+    exit 1
+fi
+
+# Zdjęcia testowe, presety i pamięć podręczna zdjęć tylko w katalogu tymczasowym
+WORK_DIR=$(mktemp -d)
+trap 'rm -rf "$WORK_DIR"' EXIT
+export XDG_CACHE_HOME="$WORK_DIR/cache"
+
+g++ "$TESTS_DIR/make_gradient.cpp" -Wall -Wextra `pkg-config opencv4 --cflags --libs` -o "$WORK_DIR/make_gradient" || exit 1
+"$WORK_DIR/make_gradient" "$WORK_DIR/gradient.png" || exit 1
+echo "-e -0.7 -s 1.2" > "$WORK_DIR/maska.txt"
+cd "$WORK_DIR" || exit 1
+mkdir -p "$GOLDEN_DIR"
+
+# Ścieżka programu wersji referencyjnej, zbudowanego przy pierwszym użyciu w tests/.build/<commit>
+referenceProgram()
+{
+    case "$1" in
+        -) echo "$PROGRAM"; return 0 ;;
+        bazowa) revision=$BASE_REVISION ;;
+        klarownosc) revision=$CLARITY_REVISION ;;
+        auto) revision=$AUTO_REVISION ;;
+        *) echo "Nieznana wersja referencyjna $1!" >&2; return 1 ;;
+    esac
+
+    commit=$(git -C "$REPO_DIR" rev-parse --verify -q "$revision") || { echo "Nie znaleziono wersji $revision!" >&2; return 1; }
+    directory="$BUILD_DIR/$commit"
+    if [ ! -x "$directory/program" ]; then
+        mkdir -p "$directory"
+        git -C "$REPO_DIR" archive "$commit" main.cpp resources | tar -x -C "$directory" || return 1
+        g++ "$directory/main.cpp" $CXXFLAGS -Wall -Wextra `pkg-config opencv4 gtk+-2.0 --cflags --libs` -o "$directory/program" >&2 || return 1
+    fi
+    echo "$directory/program"
+}
+
+# Nazwa wzorca, wersja referencyjna i flagi (ścieżki względem katalogu tymczasowego, wartości bez spacji)
+# Wyostrzanie działa dopiero przy zapisie, więc z -sp porównywany jest zapisany plik (wczytany bez zmian ustawień)
+failed=0
+while read -r name reference flags; do
+    golden="$GOLDEN_DIR/$name.png"
+    if [ ! -f "$golden" ] || [ $UPDATE -eq 1 ]; then
+        program=$(referenceProgram "$reference") && "$program" gradient.png $flags -o "$golden" > "$name.log" 2>&1
+        if [ $? -ne 0 ]; then
+            echo "BŁĄD   $name (nie można wygenerować wzorca wersją $reference)"
+            cat "$name.log" 2>/dev/null
+            failed=$((failed + 1))
+            continue
+        fi
+        echo "NOWY   $name (wersja $reference)"
+    fi
+
+    case " $flags " in
+        *" -sp "*) "$PROGRAM" gradient.png $flags -o "$name.png" > "$name.log" 2>&1 && "$PROGRAM" "$name.png" -ref "$golden" -tol "$TOLERANCE" >> "$name.log" 2>&1 ;;
+        *) "$PROGRAM" gradient.png $flags -ref "$golden" -tol "$TOLERANCE" > "$name.log" 2>&1 ;;
+    esac
+    if [ $? -eq 0 ]; then
+        echo "OK     $name"
+    else
+        echo "BŁĄD   $name ($flags)"
+        cat "$name.log"
+        failed=$((failed + 1))
+    fi
+done <<CASES
+bez_zmian bazowa -b 0
+jasnosc bazowa -b 40
+kontrast bazowa -c 60
+ekspozycja bazowa -e 0.7
+saturacja bazowa -s 1.8
+temperatura bazowa -t 60
+odcien bazowa -hr 40 -hg -40 -hb 40
+lift bazowa -l 30
+gamma bazowa -g 1.4
+gain bazowa -gn 1.3
+cienie bazowa -sh 0.6
+tony_srednie bazowa -md -0.4
+przeswietlenia bazowa -hl -0.6
+kombinacja bazowa -c 30 -s 1.4 -e 0.3 -sh 0.4 -hl -0.3 -t 20 -g 1.2
+klarownosc klarownosc -cl 0.7
+klarownosc_kombinacja klarownosc -cl 0.7 -c 30 -s 1.4 -sh 0.4
+automatyczne auto --auto
+automatyczne_kontrast - --auto -c 40 -sh 0.2
+ekspozycja_liniowa - -e 0.7 --linear
+saturacja_liniowa - -s 1.8 --linear
+balans_bieli - -k 3500 -tn 0.3
+balans_bieli_liniowy - -k 3500 -tn 0.3 --linear
+balans_bieli_klarownosc - -k 3000 -cl 0.5
+mikser_klarownosc - -mx 0.8,0.2,0,0.1,0.9,0,0,0.3,0.7 -cl 0.5 --linear
+mikser - -mx 0.8,0.2,0,0.1,0.9,0,0,0.3,0.7
+winieta - -v -0.6
+winieta_liniowa - -v -0.6 --linear
+winieta_klarownosc - -v -0.6 -cl 1
+odszumianie - -dn 0.6
+odszumianie_klarownosc - -dn 0.6 -cl 0.5
+hsl_nasycenie - -hsls 0.5,0,-0.5,0,0.5,0,-0.5,0
+hsl_jasnosc - -hsll -0.5,0,0.5,0,-0.5,0,0.5,0
+krzywe - -cv 0:0,64:90,192:200,255:255 -cvr 0:20,255:235
+maska_liniowa - -mask linear:0.5,0,0.5,0.45 -mask-preset maska.txt
+maska_radialna - -mask radial:0.5,0.5,0.3,0.2,0.1 -mask-invert -mask-preset maska.txt
+wyostrzanie - -sp 0.8
+wyostrzanie_kombinacja - -sp 0.8 -c 30 -s 1.4 -cl 0.5
+CASES
+
+# Wydajność względem wersji bazowej na tym samym zdjęciu i z tymi samymi flagami
+"$WORK_DIR/make_gradient" duzy.png 6000 4000 || exit 1
+baseProgram=$(referenceProgram bazowa) || exit 1
+baseMegapixels=$("$baseProgram" duzy.png $PERF_FLAGS -bench "$PERF_RUNS" | sed -n 's/^Najlepszy render: .*s (\(.*\) Mpx\/s)$/\1/p')
+if [ -z "$baseMegapixels" ]; then
+    echo "BŁĄD   wydajność (brak pomiaru wersji bazowej)"
+    failed=$((failed + 1))
+else
+    minMegapixels=$(echo "$baseMegapixels $PERF_MARGIN" | awk '{ printf "%.2f", $1 * $2 }')
+    if "$PROGRAM" duzy.png $PERF_FLAGS -bench "$PERF_RUNS" -minmpx "$minMegapixels" > wydajnosc.log 2>&1; then
+        echo "OK     wydajność (wersja bazowa $baseMegapixels Mpx/s, próg $minMegapixels Mpx/s)"
+    else
+        echo "BŁĄD   wydajność (wersja bazowa $baseMegapixels Mpx/s, próg $minMegapixels Mpx/s)"
+        cat wydajnosc.log
+        failed=$((failed + 1))
+    fi
+fi
+
+if [ $failed -gt 0 ]; then
+    echo "Nieudane testy: $failed"
+    exit 1
+fi
+echo "Wszystkie testy zakończone powodzeniem"
+exit 0